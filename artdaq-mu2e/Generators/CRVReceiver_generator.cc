@@ -1,4 +1,5 @@
 #include "artdaq-mu2e/Generators/Mu2eEventReceiverBase.hh"
+#include "artdaq-mu2e/Generators/detail/SequenceIDWindow.hh"
 
 #include "artdaq/Generators/GeneratorMacros.hh"
 
@@ -20,23 +21,36 @@ private:
 
 	bool getNext_(artdaq::FragmentPtrs& output) override;
 
+	void start() override;
+
+	// no_request_mode: read the next streamBatch_ sequential EWTs; runs on the prefetch thread when prefetch_ring_depth > 0
+	bool streamWindows_(artdaq::FragmentPtrs& output);
+
 	std::shared_ptr<artdaq::RequestBuffer> requests_{nullptr};
 
-	std::set<artdaq::Fragment::sequence_id_t> seen_sequence_ids_{};
-	size_t sequence_id_list_max_size_{1000};
+	detail::SequenceIDWindow seen_sequence_ids_;  // Requests already serviced, over the last request_dedup_window sequence IDs
+
+	bool coalesceRequests_{true};  // Answer a batch of requests from shared DTC reads instead of one read per request
 
-        bool noRequestMode_{false};
-        size_t noRequestModeFirstTimestamp_{0};
+	int requestWaitMs_{10};
+
+	bool noRequestMode_{false};  // Stream sequential EWTs instead of waiting for requests
+	size_t noRequestModeFirstTimestamp_{0};
+	size_t streamBatch_{1};
+	uint64_t nextStreamTimestamp_{1};
+	artdaq::Fragment::sequence_id_t nextStreamSequenceID_{1};  // Keeps rising when the EWTs start over with the sim file
 };
 }  // namespace mu2e
 
 mu2e::CRVReceiver::CRVReceiver(fhicl::ParameterSet const& ps)
 	: Mu2eEventReceiverBase(ps)
-        , noRequestMode_(ps.get<bool>("no_request_mode", false))
-        , noRequestModeFirstTimestamp_(ps.get<size_t>("no_request_mode_first_timestamp",0))
+	, seen_sequence_ids_(ps.get<size_t>("request_dedup_window", 1024))
+	, coalesceRequests_(ps.get<bool>("coalesce_requests", true))
+	, requestWaitMs_(ps.get<int>("request_wait_timeout_ms", 10))
+	, noRequestMode_(ps.get<bool>("no_request_mode", false))
+	, noRequestModeFirstTimestamp_(ps.get<size_t>("no_request_mode_first_timestamp", 0))
+	, streamBatch_(std::max(ps.get<size_t>("no_request_mode_batch", 16), size_t(1)))
 {
-
-	highest_timestamp_seen_ = noRequestModeFirstTimestamp_;
 	TLOG(TLVL_DEBUG) << "CRVReceiver Initialized with mode " << mode_;
 }
 
@@ -44,64 +58,128 @@ mu2e::CRVReceiver::~CRVReceiver()
 {
 }
 
-bool mu2e::CRVReceiver::getNext_(artdaq::FragmentPtrs& frags) 
-{ 
-	while (!simFileRead_ && !should_stop())
+void mu2e::CRVReceiver::start()
+{
+	Mu2eEventReceiverBase::start();
+	seen_sequence_ids_.reset();  // Sequence IDs start over with each run
+	requests_ = nullptr;
+	nextStreamTimestamp_ = noRequestModeFirstTimestamp_ + 1;
+	nextStreamSequenceID_ = nextStreamTimestamp_;
+	if (noRequestMode_ && prefetcher_)
 	{
-		usleep(5000);
+		prefetcher_->start([this](artdaq::FragmentPtrs& frags) { return streamWindows_(frags); });
 	}
+}
 
-	std::map<artdaq::Fragment::sequence_id_t, artdaq::Fragment::timestamp_t> reqs;
+bool mu2e::CRVReceiver::getNext_(artdaq::FragmentPtrs& frags)
+{
 	if (noRequestMode_)
 	{
-		std::cout << "DEBUG highest_timestamp_seen_=" << highest_timestamp_seen_ << std::endl;
-		reqs[highest_timestamp_seen_ + 1] = highest_timestamp_seen_ + 1;
+		if (prefetcher_) return drainPrefetcher_(frags);
+		auto ret = streamWindows_(frags);
+		recordEmit_(frags);
+		return ret;
 	}
-	else
+
+	if (!waitForSimFile_())
 	{
-		if (requests_ == nullptr)
-		{
-			requests_ = GetRequestBuffer();
-		}
-		if (requests_ == nullptr)
-		{
-			TLOG(TLVL_ERROR) << "Request Buffer pointer is null! Returning false!";
-			return false;
-		}
+		return false;
+	}
 
-		while (!should_stop() && !requests_->WaitForRequests(100))
-		{
-		}
-		reqs = requests_->GetAndClearRequests();
-		//requests_->reset();
+	if (requests_ == nullptr)
+	{
+		requests_ = GetRequestBuffer();
+	}
+	if (requests_ == nullptr)
+	{
+		TLOG(TLVL_ERROR) << "Request Buffer pointer is null! Returning false!";
+		return false;
 	}
 
+	// WaitForRequests wakes as soon as a request is added; the timeout only bounds how long a stop can go unnoticed
+	while (!should_stop() && !requests_->WaitForRequests(requestWaitMs_))
+	{
+	}
 	if (should_stop())
 	{
 		return false;
 	}
+	auto reqs = requests_->GetAndClearRequests();
+	auto requests_received = std::chrono::steady_clock::now();
+	auto frags_before = frags.size();
 
+	size_t duplicate_requests = 0;
+	size_t stale_requests = 0;
+	std::map<artdaq::Fragment::sequence_id_t, artdaq::Fragment::timestamp_t> batch;
 	for (auto& req : reqs)
 	{
-		if (seen_sequence_ids_.count(req.first))
+		auto seen = seen_sequence_ids_.insert(req.first);
+		if (seen == detail::SequenceIDWindow::Result::Duplicate)
 		{
+			++duplicate_requests;
 			continue;
 		}
-		else
+		if (seen == detail::SequenceIDWindow::Result::Stale)
 		{
-			seen_sequence_ids_.insert(req.first);
-			if (seen_sequence_ids_.size() > sequence_id_list_max_size_)
-			{
-				seen_sequence_ids_.erase(seen_sequence_ids_.begin());
-			}
+			// Too old to tell whether it was already serviced; read it again rather than risk dropping it
+			++stale_requests;
 		}
 		TLOG(TLVL_DEBUG) << "Requesting CRV data for Event Window Tag " << req.second;
+		if (coalesceRequests_)
+		{
+			batch.insert(req);
+			continue;
+		}
 		auto ret = getNextDTCFragment(frags, DTCLib::DTC_EventWindowTag(req.second), req.first);
 		if (!ret) return false;
 	}
+	if (!batch.empty() && !getRequestedDTCFragments(frags, batch))
+	{
+		return false;
+	}
+
+	if (frags.size() > frags_before)
+	{
+		// For CRV the request is artdaq's: from the request batch being taken to its data being read out
+		latency_.record(detail::StageLatencies::RequestToData, requests_received, std::chrono::steady_clock::now());
+	}
+	recordEmit_(frags);
+
+	metricMan->sendMetric("Duplicate Requests", duplicate_requests, "requests", 3, artdaq::MetricMode::Accumulate);
+	metricMan->sendMetric("Stale Requests", stale_requests, "requests", 3, artdaq::MetricMode::Accumulate);
 
 	return true;
 }
 
+bool mu2e::CRVReceiver::streamWindows_(artdaq::FragmentPtrs& frags)
+{
+	if (!waitForSimFile_())
+	{
+		return false;
+	}
+
+	// Ask for the next few EWTs at once; each one is its own sequence ID, as in request mode
+	std::map<artdaq::Fragment::sequence_id_t, artdaq::Fragment::timestamp_t> batch;
+	for (size_t ii = 0; ii < streamBatch_; ++ii)
+	{
+		batch[nextStreamSequenceID_ + ii] = nextStreamTimestamp_ + ii;
+	}
+	TLOG(TLVL_TRACE + 21) << "Streaming CRV data for Event Window Tags " << nextStreamTimestamp_ << " to " << nextStreamTimestamp_ + streamBatch_ - 1;
+
+	auto wraps = ewtSequencer_.wraps();
+	auto ret = getRequestedDTCFragments(frags, batch);
+
+	// Windows that did not arrive are skipped, not asked for again; they show up in "Unanswered Requests"
+	nextStreamSequenceID_ += streamBatch_;
+	nextStreamTimestamp_ += streamBatch_;
+	if (ewtSequencer_.wraps() > wraps)
+	{
+		// The sim file started over, so its EWTs did too; asking on from the old position would run past its end
+		nextStreamTimestamp_ = ewtSequencer_.highestSeen() + 1;
+		TLOG(TLVL_INFO) << "Sim file started over; streaming on from Event Window Tag " << nextStreamTimestamp_;
+	}
+	return ret && !should_stop();
+}
+
 // The following macro is defined in artdaq's GeneratorMacros.hh header
 DEFINE_ARTDAQ_COMMANDABLE_GENERATOR(mu2e::CRVReceiver)
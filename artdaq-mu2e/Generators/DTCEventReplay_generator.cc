@@ -0,0 +1,249 @@
+// Replays raw DTC event files (as written by raw_output_enable or DTCEventDump) as DTCEVT Fragments, without a DTC.
+// Events are read from a private memory mapping and go through the same Fragment building as Mu2eEventReceiver,
+// so event building and art can be driven at full rate on any machine.
+
+#include "artdaq-mu2e/Generators/Mu2eEventReceiverBase.hh"
+#include "artdaq-mu2e/Generators/detail/MappedDTCFile.hh"
+
+#include "artdaq/Generators/GeneratorMacros.hh"
+
+#include <cerrno>
+#include <cstring>
+
+#include "trace.h"
+#define TRACE_NAME "DTCEventReplay"
+
+namespace mu2e {
+class DTCEventReplay : public mu2e::Mu2eEventReceiverBase
+{
+public:
+	explicit DTCEventReplay(fhicl::ParameterSet const& ps);
+	virtual ~DTCEventReplay();
+
+private:
+	bool getNext_(artdaq::FragmentPtrs& output) override;
+
+	// Build one Fragment from the next events_per_fragment events; runs on the prefetch thread when prefetch_ring_depth > 0
+	bool replayEvents_(artdaq::FragmentPtrs& output);
+
+	// Point evt at the next event, moving on to the next file (and the next pass) if may_switch; false when the
+	// replay is over, or when the current file is done and may_switch is false
+	bool nextEvent_(detail::MappedDTCFile::Event& evt, bool may_switch);
+
+	// Overwrite the event window tag in the event header and every sub-event header
+	static void rewriteEventWindowTag_(detail::MappedDTCFile::Event const& evt, uint64_t ewt);
+
+	void start() override;
+
+	std::vector<std::string> input_files_;
+	size_t loop_count_;  // Passes over input_files; 0 replays until stopped
+	size_t events_per_fragment_;
+	bool rewrite_ewt_;
+	uint64_t first_ewt_;
+	size_t readahead_bytes_;
+
+	std::unique_ptr<detail::MappedDTCFile> file_;
+	size_t file_index_{0};
+	size_t pass_{0};
+	uint64_t events_replayed_{0};
+};
+}  // namespace mu2e
+
+mu2e::DTCEventReplay::DTCEventReplay(fhicl::ParameterSet const& ps)
+	: Mu2eEventReceiverBase(ps, false)
+	, input_files_(ps.get<std::vector<std::string>>("input_files"))
+	, loop_count_(ps.get<size_t>("loop_count", 1))
+	, events_per_fragment_(std::max(ps.get<size_t>("events_per_fragment", 1), size_t(1)))
+	, rewrite_ewt_(ps.get<bool>("rewrite_ewt", true))
+	, first_ewt_(ps.get<uint64_t>("first_ewt", 1))
+	, readahead_bytes_(ps.get<size_t>("replay_readahead_bytes", 64 << 20))
+{
+	if (input_files_.empty())
+	{
+		TLOG(TLVL_ERROR) << "No input_files given; the replay will end immediately";
+	}
+	if (loop_count_ != 1 && !rewrite_ewt_)
+	{
+		TLOG(TLVL_WARNING) << "Replaying the input more than once with rewrite_ewt false: event window tags will repeat";
+	}
+	TLOG(TLVL_DEBUG) << "DTCEventReplay Initialized with " << input_files_.size() << " input files, loop_count " << loop_count_;
+}
+
+mu2e::DTCEventReplay::~DTCEventReplay()
+{
+}
+
+void mu2e::DTCEventReplay::start()
+{
+	Mu2eEventReceiverBase::start();
+	file_.reset();
+	file_index_ = 0;
+	pass_ = 0;
+	events_replayed_ = 0;
+	if (prefetcher_)
+	{
+		prefetcher_->start([this](artdaq::FragmentPtrs& frags) { return replayEvents_(frags); });
+	}
+}
+
+bool mu2e::DTCEventReplay::getNext_(artdaq::FragmentPtrs& frags)
+{
+	if (prefetcher_)
+	{
+		return drainPrefetcher_(frags);
+	}
+	auto ret = replayEvents_(frags);
+	recordEmit_(frags);
+	return ret;
+}
+
+bool mu2e::DTCEventReplay::nextEvent_(detail::MappedDTCFile::Event& evt, bool may_switch)
+{
+	if (input_files_.empty()) return false;
+	size_t opened = 0;
+	while (true)
+	{
+		if (file_ && file_->next(evt))
+		{
+			return true;
+		}
+		// Events already collected for this Fragment point into the current mapping; pack them first
+		if (!may_switch) return false;
+
+		if (file_ && file_->truncated())
+		{
+			TLOG(TLVL_WARNING) << "Input file " << input_files_[file_index_] << " ends in a partial or corrupt event at byte " << file_->offset()
+							   << " of " << file_->size() << "; skipping the rest of it";
+		}
+
+		if (file_)
+		{
+			++file_index_;
+		}
+		if (file_index_ == input_files_.size())
+		{
+			file_index_ = 0;
+			++pass_;
+			if (loop_count_ > 0 && pass_ >= loop_count_)
+			{
+				file_.reset();
+				return false;
+			}
+		}
+
+		if (++opened > input_files_.size())
+		{
+			TLOG(TLVL_ERROR) << "No complete event in any input file";
+			file_.reset();
+			return false;
+		}
+		if (file_ && input_files_.size() == 1)
+		{
+			file_->rewind();
+		}
+		else
+		{
+			file_ = std::make_unique<detail::MappedDTCFile>(input_files_[file_index_], readahead_bytes_);
+			if (!file_->good())
+			{
+				TLOG(TLVL_ERROR) << "Could not map input file " << input_files_[file_index_] << ": " << strerror(errno);
+				file_.reset();
+				return false;
+			}
+		}
+		TLOG(TLVL_INFO) << "Replaying " << input_files_[file_index_] << " (" << file_->size() << " bytes, pass " << pass_ + 1 << ")";
+	}
+}
+
+void mu2e::DTCEventReplay::rewriteEventWindowTag_(detail::MappedDTCFile::Event const& evt, uint64_t ewt)
+{
+	DTCLib::DTC_EventHeader hdr;
+	memcpy(&hdr, evt.begin, sizeof(hdr));
+	hdr.event_tag_low = ewt & 0xFFFFFFFF;
+	hdr.event_tag_high = (ewt >> 32) & 0xFFFF;
+	memcpy(evt.begin, &hdr, sizeof(hdr));
+
+	size_t offset = sizeof(DTCLib::DTC_EventHeader);
+	while (offset + sizeof(DTCLib::DTC_SubEventHeader) <= evt.bytes)
+	{
+		DTCLib::DTC_SubEventHeader sub;
+		memcpy(&sub, evt.begin + offset, sizeof(sub));
+		size_t sub_bytes = sub.inclusive_subevent_byte_count;
+		if (sub_bytes < sizeof(sub) || sub_bytes > evt.bytes - offset) break;
+		sub.event_tag_low = ewt & 0xFFFFFFFF;
+		sub.event_tag_high = (ewt >> 32) & 0xFFFF;
+		memcpy(evt.begin + offset, &sub, sizeof(sub));
+		offset += sub_bytes;
+	}
+}
+
+bool mu2e::DTCEventReplay::replayEvents_(artdaq::FragmentPtrs& frags)
+{
+	applyPlacement_();
+
+	if (!pacer_.acquire(events_per_fragment_, [&]() { return should_stop(); }))
+	{
+		return false;
+	}
+	if (pacer_.enabled())
+	{
+		metricMan->sendMetric("Achieved Request Rate", pacer_.achievedRate(), "Hz", 3, artdaq::MetricMode::LastPoint);
+	}
+	if (should_stop())
+	{
+		return false;
+	}
+
+	auto before_read = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<DTCLib::DTC_Event>> data;
+	data.reserve(events_per_fragment_);
+	size_t data_bytes = 0;
+	detail::MappedDTCFile::Event evt;
+	// A Fragment never spans two files (or two passes over one), so the mapping its events point into stays valid until it is packed
+	while (data.size() < events_per_fragment_ && nextEvent_(evt, data.empty()))
+	{
+		if (rewrite_ewt_)
+		{
+			rewriteEventWindowTag_(evt, first_ewt_ + events_replayed_);
+		}
+		++events_replayed_;
+		// The DTC_Event views the mapping; packDTCEvents_ makes the only copy
+		data.emplace_back(new DTCLib::DTC_Event(evt.begin));
+		data.back()->SetupEvent();
+		data_bytes += evt.bytes;
+	}
+	if (data.empty())
+	{
+		TLOG(TLVL_INFO) << "Replay finished after " << events_replayed_ << " events";
+		return false;
+	}
+	auto after_read = std::chrono::steady_clock::now();
+
+	auto fragment_timestamp = data[0]->GetEventWindowTag().GetEventWindowTag(true);
+	if (first_timestamp_seen_ == 0)
+	{
+		first_timestamp_seen_ = fragment_timestamp;
+	}
+
+	artdaq::FragmentPtrs packed;
+	size_t bytes_copied = packDTCEvents_(data, packed, getCurrentSequenceID(), fragment_timestamp, fragment_ids_[0]);
+	frags.splice(frags.end(), packed);
+	file_->releaseBefore(file_->offset());
+
+	auto after_copy = std::chrono::steady_clock::now();
+	if (unemittedSince_ == std::chrono::steady_clock::time_point()) unemittedSince_ = after_copy;
+	ev_counter_inc();
+
+	latency_.record(detail::StageLatencies::Read, before_read, after_read);
+	latency_.record(detail::StageLatencies::Copy, after_read, after_copy);
+	latency_.publish();
+	metricMan->sendMetric("Replay Read Time", artdaq::TimeUtils::GetElapsedTime(before_read, after_read), "s", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Fragment Prep Time", artdaq::TimeUtils::GetElapsedTime(after_read, after_copy), "s", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Replayed Events", data.size(), "events", 1, artdaq::MetricMode::Rate);
+	metricMan->sendMetric("Replay Data Rate", data_bytes, "B", 1, artdaq::MetricMode::Rate);
+	metricMan->sendMetric("Fragment Bytes Copied", bytes_copied, "B", 1, artdaq::MetricMode::Rate);
+	return true;
+}
+
+// The following macro is defined in artdaq's GeneratorMacros.hh header
+DEFINE_ARTDAQ_COMMANDABLE_GENERATOR(mu2e::DTCEventReplay)
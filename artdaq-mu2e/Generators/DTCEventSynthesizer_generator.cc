@@ -0,0 +1,146 @@
+// Generates DTC_Events entirely in software and emits them as DTCEVT Fragments, without a DTC. The event shape
+// (DTCs, links, ROCs per link, packets per data block) and rate are configurable, and Fragments are built by
+// Mu2eEventReceiverBase as for real readout, so the BoardReader, EventBuilder and art modules can be
+// benchmarked beyond what the DTC simulator sustains.
+
+#include "artdaq-mu2e/Generators/Mu2eEventReceiverBase.hh"
+#include "artdaq-mu2e/Generators/detail/SyntheticEventBuilder.hh"
+
+#include "artdaq/Generators/GeneratorMacros.hh"
+
+#include "trace.h"
+#define TRACE_NAME "DTCEventSynthesizer"
+
+namespace mu2e {
+class DTCEventSynthesizer : public mu2e::Mu2eEventReceiverBase
+{
+public:
+	explicit DTCEventSynthesizer(fhicl::ParameterSet const& ps);
+	virtual ~DTCEventSynthesizer();
+
+private:
+	bool getNext_(artdaq::FragmentPtrs& output) override;
+
+	// Build one Fragment from the next events_per_fragment events; runs on the prefetch thread when prefetch_ring_depth > 0
+	bool synthesizeEvents_(artdaq::FragmentPtrs& output);
+
+	void start() override;
+
+	size_t events_per_fragment_;
+	uint64_t first_ewt_;
+	uint64_t max_events_;  // Events to generate per run; 0 generates until stopped
+	detail::SyntheticEventBuilder builder_;
+	uint64_t events_generated_{0};
+};
+}  // namespace mu2e
+
+mu2e::DTCEventSynthesizer::DTCEventSynthesizer(fhicl::ParameterSet const& ps)
+	: Mu2eEventReceiverBase(ps, false)
+	, events_per_fragment_(std::max(ps.get<size_t>("events_per_fragment", 1), size_t(1)))
+	, first_ewt_(ps.get<uint64_t>("first_ewt", 1))
+	, max_events_(ps.get<uint64_t>("synthetic_event_count", 0))
+	, builder_(ps)
+{
+	builder_.reserveDistinct(events_per_fragment_);
+	if (builder_.clamped())
+	{
+		TLOG(TLVL_WARNING) << "packets_per_block_max lowered to " << builder_.maxPacketsPerBlock() << " so every event fits the 24-bit event byte count";
+	}
+	TLOG(TLVL_DEBUG) << "DTCEventSynthesizer Initialized with " << builder_.templateCount() << " template events of " << builder_.meanEventBytes()
+					 << " bytes on average";
+}
+
+mu2e::DTCEventSynthesizer::~DTCEventSynthesizer()
+{
+}
+
+void mu2e::DTCEventSynthesizer::start()
+{
+	Mu2eEventReceiverBase::start();
+	events_generated_ = 0;
+	if (prefetcher_)
+	{
+		prefetcher_->start([this](artdaq::FragmentPtrs& frags) { return synthesizeEvents_(frags); });
+	}
+}
+
+bool mu2e::DTCEventSynthesizer::getNext_(artdaq::FragmentPtrs& frags)
+{
+	if (prefetcher_)
+	{
+		return drainPrefetcher_(frags);
+	}
+	auto ret = synthesizeEvents_(frags);
+	recordEmit_(frags);
+	return ret;
+}
+
+bool mu2e::DTCEventSynthesizer::synthesizeEvents_(artdaq::FragmentPtrs& frags)
+{
+	applyPlacement_();
+
+	size_t n_events = events_per_fragment_;
+	if (max_events_ > 0)
+	{
+		if (events_generated_ >= max_events_)
+		{
+			TLOG(TLVL_INFO) << "Generated all " << max_events_ << " synthetic events";
+			return false;
+		}
+		n_events = std::min<uint64_t>(n_events, max_events_ - events_generated_);
+	}
+
+	if (!pacer_.acquire(n_events, [&]() { return should_stop(); }))
+	{
+		return false;
+	}
+	if (pacer_.enabled())
+	{
+		metricMan->sendMetric("Achieved Request Rate", pacer_.achievedRate(), "Hz", 3, artdaq::MetricMode::LastPoint);
+	}
+	if (should_stop())
+	{
+		return false;
+	}
+
+	auto before_read = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<DTCLib::DTC_Event>> data;
+	data.reserve(n_events);
+	size_t data_bytes = 0;
+	for (size_t ii = 0; ii < n_events; ++ii)
+	{
+		auto evt = builder_.next(first_ewt_ + events_generated_);
+		++events_generated_;
+		// The DTC_Event views the template; packDTCEvents_ makes the only copy
+		data.emplace_back(new DTCLib::DTC_Event(evt.begin));
+		data.back()->SetupEvent();
+		data_bytes += evt.bytes;
+	}
+	auto after_read = std::chrono::steady_clock::now();
+	auto fragment_timestamp = data[0]->GetEventWindowTag().GetEventWindowTag(true);
+	if (first_timestamp_seen_ == 0)
+	{
+		first_timestamp_seen_ = fragment_timestamp;
+	}
+
+	artdaq::FragmentPtrs packed;
+	size_t bytes_copied = packDTCEvents_(data, packed, getCurrentSequenceID(), fragment_timestamp, fragment_ids_[0]);
+	frags.splice(frags.end(), packed);
+
+	auto after_copy = std::chrono::steady_clock::now();
+	if (unemittedSince_ == std::chrono::steady_clock::time_point()) unemittedSince_ = after_copy;
+	ev_counter_inc();
+
+	latency_.record(detail::StageLatencies::Read, before_read, after_read);
+	latency_.record(detail::StageLatencies::Copy, after_read, after_copy);
+	latency_.publish();
+	metricMan->sendMetric("Event Generation Time", artdaq::TimeUtils::GetElapsedTime(before_read, after_read), "s", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Fragment Prep Time", artdaq::TimeUtils::GetElapsedTime(after_read, after_copy), "s", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Synthetic Events", data.size(), "events", 1, artdaq::MetricMode::Rate);
+	metricMan->sendMetric("Synthetic Data Rate", data_bytes, "B", 1, artdaq::MetricMode::Rate);
+	metricMan->sendMetric("Fragment Bytes Copied", bytes_copied, "B", 1, artdaq::MetricMode::Rate);
+	return true;
+}
+
+// The following macro is defined in artdaq's GeneratorMacros.hh header
+DEFINE_ARTDAQ_COMMANDABLE_GENERATOR(mu2e::DTCEventSynthesizer)
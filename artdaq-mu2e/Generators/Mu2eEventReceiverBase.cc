@@ -2,12 +2,14 @@
 #include "artdaq-core-mu2e/Overlays/FragmentType.hh"
 
 #include "artdaq-core/Data/ContainerFragmentLoader.hh"
+#include "artdaq-mu2e/Generators/detail/ContainerFragmentBuilder.hh"
 #include "artdaq/DAQdata/Globals.hh"
+#include "cetlib_except/exception.h"
 
 #include "trace.h"
 #define TRACE_NAME "Mu2eEventReceiverBase"
 
-mu2e::Mu2eEventReceiverBase::Mu2eEventReceiverBase(fhicl::ParameterSet const& ps)
+mu2e::Mu2eEventReceiverBase::Mu2eEventReceiverBase(fhicl::ParameterSet const& ps, bool open_dtc, bool multi_card)
 	: CommandableFragmentGenerator(ps)
 	, fragment_ids_{static_cast<artdaq::Fragment::fragment_id_t>(fragment_id())}
 	, mode_(DTCLib::DTC_SimModeConverter::ConvertToSimMode(ps.get<std::string>("sim_mode", "Disabled")))
@@ -16,93 +18,227 @@ mu2e::Mu2eEventReceiverBase::Mu2eEventReceiverBase(fhicl::ParameterSet const& ps
 	, rawOutputFile_(ps.get<std::string>("raw_output_file", "/tmp/Mu2eReceiver.bin"))
 	, print_packets_(ps.get<bool>("debug_print", false))
 	, heartbeats_after_(ps.get<size_t>("null_heartbeats_after_requests", 16))
+	, directFragmentReadout_(ps.get<bool>("direct_fragment_readout", false))
+	, verifyContainers_(ps.get<bool>("verify_container_fragments", true))
 	, dtc_offset_(ps.get<size_t>("dtc_position_in_chain", 0))
 	, n_dtcs_(ps.get<size_t>("n_dtcs_in_chain", 1))
         , request_rate_(ps.get<float>("request_rate", -1.))// Hz
+        , pacer_(request_rate_, ps.get<size_t>("request_burst", 1))
         , diagLevel_(ps.get<int>("diagLevel", 0))
         , frag_sent_(0)
+	, readoutWait_(ps)
+	, ewtSequencer_(ps)
+	, latency_(ps)
 {
-	// mode_ can still be overridden by environment!
-	theInterface_ = std::make_unique<DTCLib::DTC>(mode_,
-									ps.get<int>("dtc_id", -1),
-									ps.get<unsigned>("roc_mask", 0x1),
-									ps.get<std::string>("dtc_fw_version", ""),
-									skip_dtc_init_,
-									ps.get<std::string>("simulator_memory_file_name", "mu2esim.bin"));
-
-	mode_ = theInterface_->GetSimMode();
+	if (open_dtc)
+	{
+		// mode_ can still be overridden by environment!
+		theInterface_ = std::make_unique<DTCLib::DTC>(mode_,
+													  ps.get<int>("dtc_id", -1),
+													  ps.get<unsigned>("roc_mask", 0x1),
+													  ps.get<std::string>("dtc_fw_version", ""),
+													  skip_dtc_init_,
+													  ps.get<std::string>("simulator_memory_file_name", "mu2esim.bin"));
+		mode_ = theInterface_->GetSimMode();
+	}
+	else
+	{
+		mode_ = DTCLib::DTC_SimMode_Disabled;
+	}
 	TLOG(TLVL_DEBUG) << "Mu2eEventReceiverBase Initialized with mode " << mode_;
 
-	if(request_rate_ <= 0) request_rate_ = std::numeric_limits<double>::max();
-	sending_start_ = std::chrono::steady_clock::now();
+	rawOutputConfig_.buffer_bytes = ps.get<size_t>("raw_output_buffer_bytes", 16 << 20);
+	rawOutputConfig_.buffer_count = ps.get<size_t>("raw_output_buffer_count", 2);
+	rawOutputConfig_.direct_io = ps.get<bool>("raw_output_direct_io", false);
+	rawOutputConfig_.rotate_bytes = ps.get<size_t>("raw_output_rotate_bytes", 0);
+	rawOutputConfig_.rotate_seconds = ps.get<size_t>("raw_output_rotate_seconds", 0);
+	rawOutputConfig_.drop_policy = detail::RawOutputWriter::parseDropPolicy(ps.get<std::string>("raw_output_drop_policy", "newest"));
+
+	auto prefetch_depth = ps.get<size_t>("prefetch_ring_depth", 0);
+	if (prefetch_depth > 0)
+	{
+		prefetcher_ = std::make_unique<detail::FragmentPrefetcher>(prefetch_depth);
+	}
+
+	placement_ = detail::ThreadPlacement(ps, ps.get<int>("dtc_id", -1));
+
+	auto pool_size = ps.get<size_t>("fragment_pool_size", 0);
+	if (pool_size > 0)
+	{
+		fragmentPool_ = std::make_unique<detail::FragmentPool>(pool_size,
+															   ps.get<size_t>("max_fragment_size_bytes", 0x100000),
+															   ps.get<bool>("fragment_pool_huge_pages", false),
+															   placement_.numa_node);
+	}
+
+	auto dtc_ids = ps.get<std::vector<int>>("dtc_ids", std::vector<int>());
+	if (dtc_ids.size() > 1 && !multi_card)
+	{
+		// The card threads would call GetData alongside this generator's own readout
+		throw cet::exception("Mu2eEventReceiverBase") << "dtc_ids with more than one DTC is only supported by Mu2eEventReceiver";
+	}
+
+	// Software event sources only use the Fragment building, pool, raw output and metrics
+	if (!open_dtc) return;
 
 	//if in simulation mode, setup CFO
 	if (mode_ != 0)
 	{
-		fhicl::ParameterSet cfoConfig = ps.get<fhicl::ParameterSet>("cfo_config", fhicl::ParameterSet());
-		theCFO_ = std::make_unique<DTCLib::DTCSoftwareCFO>(theInterface_.get(),
-											cfoConfig.get<bool>("use_dtc_cfo_emulator", true),
-											cfoConfig.get<size_t>("debug_packet_count", 0),
-											DTCLib::DTC_DebugTypeConverter::ConvertToDebugType(cfoConfig.get<std::string>("debug_type", "2")),
-											cfoConfig.get<bool>("sticky_debug_type", false),
-											cfoConfig.get<bool>("quiet", false),
-											cfoConfig.get<bool>("asyncRR", false),
-											cfoConfig.get<bool>("force_no_debug_mode", false),
-											cfoConfig.get<bool>("useCFODRP", false));
+		theCFO_ = makeCFO_(theInterface_.get(), ps);
+	}
+
+	if (dtc_ids.size() > 1)
+	{
+		auto card_fragment_ids = ps.get<std::vector<int>>("dtc_fragment_ids", std::vector<int>());
+		auto card_cpus = ps.get<std::vector<int>>("dtc_readout_cpus", std::vector<int>());
+		auto ring_depth = std::max(ps.get<size_t>("prefetch_ring_depth", 0), size_t(16));
+		if (prefetcher_)
+		{
+			TLOG(TLVL_WARNING) << "prefetch_ring_depth only sets the per-card ring depth when dtc_ids has more than one entry";
+			prefetcher_.reset();
+		}
+
+		fragment_ids_.clear();
+		for (size_t ii = 0; ii < dtc_ids.size(); ++ii)
+		{
+			auto card = std::make_unique<DTCCard>(ring_depth, ps, request_rate_, ps.get<size_t>("request_burst", 1));
+			card->dtc_id = dtc_ids[ii];
+			card->fragment_id = ii < card_fragment_ids.size() ? card_fragment_ids[ii] : fragment_id() + ii;
+			card->placement = detail::ThreadPlacement(ii < card_cpus.size() ? std::vector<int>{card_cpus[ii]} : placement_.cpus,
+													  ps.get<int>("readout_numa_node", -1), dtc_ids[ii]);
+			if (ii == 0)
+			{
+				// theInterface_ was opened with dtc_id; reopen it if the list names a different card first
+				if (dtc_ids[0] != ps.get<int>("dtc_id", -1))
+				{
+					theInterface_ = std::make_unique<DTCLib::DTC>(mode_, dtc_ids[0],
+																  ps.get<unsigned>("roc_mask", 0x1),
+																  ps.get<std::string>("dtc_fw_version", ""),
+																  skip_dtc_init_,
+																  ps.get<std::string>("simulator_memory_file_name", "mu2esim.bin"));
+					if (mode_ != 0) theCFO_ = makeCFO_(theInterface_.get(), ps);
+				}
+				card->dtc = theInterface_.get();
+				card->cfo = theCFO_.get();
+			}
+			else
+			{
+				card->ownedInterface = std::make_unique<DTCLib::DTC>(mode_, dtc_ids[ii],
+																	 ps.get<unsigned>("roc_mask", 0x1),
+																	 ps.get<std::string>("dtc_fw_version", ""),
+																	 skip_dtc_init_,
+																	 ps.get<std::string>("simulator_memory_file_name", "mu2esim.bin"));
+				card->dtc = card->ownedInterface.get();
+				if (mode_ != 0)
+				{
+					card->ownedCFO = makeCFO_(card->dtc, ps);
+					card->cfo = card->ownedCFO.get();
+				}
+			}
+			TLOG(TLVL_INFO) << "DTC " << card->dtc_id << " will be read out as fragment ID " << card->fragment_id;
+			fragment_ids_.push_back(card->fragment_id);
+			cards_.emplace_back(std::move(card));
+		}
 	}
 	
 	if(skip_dtc_init_) return; //skip any control of DTC 
 
-	if (ps.get<bool>("load_sim_file", false))
+	// Every card gets the same detector emulator setup; each uploads the sim file on its own thread
+	bool multi = !cards_.empty();
+	for (size_t ii = 0; ii < std::max(cards_.size(), size_t(1)); ++ii)
 	{
-		theInterface_->SetDetectorEmulatorInUse();
-		theInterface_->ResetDDR();
-		theInterface_->SoftReset();
-
-		char* file_c = getenv("DTCLIB_SIM_FILE");
+		DTCLib::DTC* dtc = multi ? cards_[ii]->dtc : theInterface_.get();
+		int dtc_id = multi ? cards_[ii]->dtc_id : ps.get<int>("dtc_id", -1);
 
-		auto sim_file = ps.get<std::string>("sim_file", "");
-		if (file_c != nullptr)
+		if (ps.get<bool>("load_sim_file", false))
 		{
-			sim_file = std::string(file_c);
+			dtc->SetDetectorEmulatorInUse();
+
+			char* file_c = getenv("DTCLIB_SIM_FILE");
+
+			auto sim_file = ps.get<std::string>("sim_file", "");
+			if (file_c != nullptr)
+			{
+				sim_file = std::string(file_c);
+			}
+			if (sim_file.size() > 0)
+			{
+				// Resets DDR itself, unless the file is already there
+				auto upload = std::make_unique<detail::SimFileUpload>(ps, dtc_id, multi);
+				upload->start(dtc, sim_file);
+				(ii == 0 ? simFileUpload_ : cards_[ii]->simUpload) = std::move(upload);
+			}
+			else
+			{
+				detail::SimFileUpload::invalidateCache(ps, dtc_id, multi);
+				dtc->ResetDDR();
+				dtc->SoftReset();
+			}
 		}
-		if (sim_file.size() > 0)
+		else
 		{
-			simFileRead_ = false;
-			std::thread reader(&mu2e::Mu2eEventReceiverBase::readSimFile_, this, sim_file);
-			reader.detach();
+			dtc->ClearDetectorEmulatorInUse();  // Needed if we're doing ROC Emulator...make sure Detector Emulation
+												// is disabled
 		}
 	}
-	else
-	{
-		theInterface_->ClearDetectorEmulatorInUse();  // Needed if we're doing ROC Emulator...make sure Detector Emulation
-													  // is disabled
-		simFileRead_ = true;
-	}
 }
 mu2e::Mu2eEventReceiverBase::~Mu2eEventReceiverBase() {}
 
-void mu2e::Mu2eEventReceiverBase::readSimFile_(std::string sim_file)
+std::unique_ptr<DTCLib::DTCSoftwareCFO> mu2e::Mu2eEventReceiverBase::makeCFO_(DTCLib::DTC* dtc, fhicl::ParameterSet const& ps)
+{
+	fhicl::ParameterSet cfoConfig = ps.get<fhicl::ParameterSet>("cfo_config", fhicl::ParameterSet());
+	return std::make_unique<DTCLib::DTCSoftwareCFO>(dtc,
+													cfoConfig.get<bool>("use_dtc_cfo_emulator", true),
+													cfoConfig.get<size_t>("debug_packet_count", 0),
+													DTCLib::DTC_DebugTypeConverter::ConvertToDebugType(cfoConfig.get<std::string>("debug_type", "2")),
+													cfoConfig.get<bool>("sticky_debug_type", false),
+													cfoConfig.get<bool>("quiet", false),
+													cfoConfig.get<bool>("asyncRR", false),
+													cfoConfig.get<bool>("force_no_debug_mode", false),
+													cfoConfig.get<bool>("useCFODRP", false));
+}
+
+bool mu2e::Mu2eEventReceiverBase::waitForSimFile_()
 {
-	TLOG(TLVL_INFO) << "Starting read of simulation file " << sim_file << "."
-					<< " Please wait to start the run until finished.";
-	theInterface_->WriteSimFileToDTC(sim_file, true);
-	simFileRead_ = true;
-	TLOG(TLVL_INFO) << "Done reading simulation file into DTC memory.";
+	return simFileUpload_ ? simFileUpload_->wait([this]() { return should_stop(); }) : true;
 }
 
 void mu2e::Mu2eEventReceiverBase::stop()
 {
-	rawOutputStream_.close();
+	if (prefetcher_) prefetcher_->stop();  // The prefetch thread may still be writing raw output
+	for (auto& card : cards_) card->reader.stop();
+	TLOG(TLVL_INFO) << "Readout latencies for this run:" << latency_.dump();
+	if (rawOutputWriter_)
+	{
+		rawOutputWriter_->close();
+		TLOG(TLVL_INFO) << "Raw output: " << rawOutputWriter_->bytes_written() << " bytes written, " << rawOutputWriter_->dropped() << " events dropped";
+		rawOutputWriter_.reset();
+	}
 	
-	if(skip_dtc_init_) return; //skip any control of DTC
+	if(skip_dtc_init_ || !theInterface_) return; //skip any control of DTC
 
 	theInterface_->DisableDetectorEmulator();
 	theInterface_->DisableCFOEmulation();
+	for (auto& card : cards_)
+	{
+		if (!card->ownedInterface) continue;
+		card->ownedInterface->DisableDetectorEmulator();
+		card->ownedInterface->DisableCFOEmulation();
+	}
 }
 
 void mu2e::Mu2eEventReceiverBase::start()
 {
+	pacer_.reset();
+	ewtSequencer_.reset();
+	latency_.reset();
+	unemittedSince_ = {};
+	placementApplied_ = false;
+	if (cards_.empty())
+	{
+		TLOG(TLVL_INFO) << "Readout placement: " << placement_.describe();
+	}
+
 	if (rawOutput_)
 	{
 		std::string fileName = rawOutputFile_;
@@ -111,31 +247,46 @@ void mu2e::Mu2eEventReceiverBase::start()
 			std::string timestr = "_" + std::to_string(time(0));
 			fileName.insert(fileName.find(".bin"), timestr);
 		}
-		rawOutputStream_.open(fileName, std::ios::out | std::ios::app | std::ios::binary);
+		rawOutputConfig_.file_name = fileName;
+		rawOutputWriter_ = std::make_unique<detail::RawOutputWriter>(rawOutputConfig_);
+	}
+
+	for (auto& card : cards_)
+	{
+		card->pacer.reset();
+		card->sequencer.reset();
+		card->windows_read = 0;
+		card->placed = false;
+		TLOG(TLVL_INFO) << "Readout placement for DTC " << card->dtc_id << ": " << card->placement.describe();
+		card->reader.start([this, c = card.get()](artdaq::FragmentPtrs& frags) { return readCard_(*c, frags); });
 	}
 }
 
 bool mu2e::Mu2eEventReceiverBase::getNextDTCFragment(artdaq::FragmentPtrs& frags, DTCLib::DTC_EventWindowTag ts_in, artdaq::Fragment::sequence_id_t seq_in)
 {
+	applyPlacement_();
+
 	auto before_read = std::chrono::steady_clock::now();
-	int retryCount = 5;
 	std::vector<std::unique_ptr<DTCLib::DTC_Event>> data;
-	while (data.size() == 0 && retryCount >= 0)
+	readoutWait_.begin();
+	do
 	{
 		try
 		{
 			TLOG(TLVL_TRACE + 25) << "Calling theInterface->GetData(" << ts_in.GetEventWindowTag(true) << ")";
 			data = theInterface_->GetData(ts_in);
-			TLOG(TLVL_TRACE + 25) << "Done calling theInterface->GetData(" << ts_in.GetEventWindowTag(true) << ") data.size()=" << data.size() << ", retryCount=" << retryCount;
+			TLOG(TLVL_TRACE + 25) << "Done calling theInterface->GetData(" << ts_in.GetEventWindowTag(true) << ") data.size()=" << data.size();
 		}
 		catch (std::exception const& ex)
 		{
 			TLOG(TLVL_ERROR) << "There was an error in the DTC Library: " << ex.what();
 		}
-		retryCount--;
-	}
-	if (retryCount < 0 && data.size() == 0)
+	} while (data.size() == 0 && !should_stop() && readoutWait_.next());
+	readoutWait_.finish(data.size() > 0);
+	if (data.size() == 0)
 	{
+		// Nothing more is coming for now; don't hold Fragments back waiting for EWTs that may never arrive
+		ewtSequencer_.flush(frags);
 		// Return true if no data in external CFO mode, otherwise false
 		return mode_ == 0;
 	}
@@ -173,7 +324,7 @@ bool mu2e::Mu2eEventReceiverBase::getNextDTCFragment(artdaq::FragmentPtrs& frags
 	{
 		for (auto& evt : data)
 		{
-			evt->WriteEvent(rawOutputStream_, false);
+			rawOutputWriter_->write(evt->GetRawBufferPointer(), evt->GetEventByteCount());
 		}
 	}
 
@@ -186,65 +337,415 @@ bool mu2e::Mu2eEventReceiverBase::getNextDTCFragment(artdaq::FragmentPtrs& frags
 		first_timestamp_seen_ = fragment_timestamp;
 	}
 
-	if (fragment_timestamp < highest_timestamp_seen_)
+	fragment_timestamp = ewtSequencer_.unroll(fragment_timestamp);
+
+	artdaq::FragmentPtrs packed;
+	size_t bytes_copied = packDTCEvents_(data, packed, seq_out, fragment_timestamp, fragment_ids_[0]);
+	size_t data_bytes = 0;
+	for (auto& evt : data) data_bytes += evt->GetEventByteCount();
+	// Requested sequence IDs are tied to their EWT, so only read-order IDs are handed out again in EWT order
+	ewtSequencer_.push(std::move(packed.back()), frags, seq_in == 0);
+
+	auto after_copy = std::chrono::steady_clock::now();
+	if (unemittedSince_ == std::chrono::steady_clock::time_point()) unemittedSince_ = after_copy;
+	if (!ewtSequencer_.dropped())  // A duplicate window is read again under the same sequence ID
 	{
-		fragment_timestamp += timestamp_loops_ * highest_timestamp_seen_;
+		TLOG(TLVL_TRACE + 20) << "Incrementing event counter";
+		ev_counter_inc();
 	}
-	else if (fragment_timestamp > highest_timestamp_seen_)
+
+	TLOG(TLVL_TRACE + 20) << "Reporting Metrics";
+	auto hwTime = theInterface_->GetDevice()->GetDeviceTime();
+
+	// Everything in this read crossed PCIe in hwTime, not just the last event
+	double hw_timestamp_rate = 1 / hwTime;
+	double hw_data_rate = data_bytes / hwTime;
+
+	latency_.record(detail::StageLatencies::Read, before_read, after_read);
+	latency_.record(detail::StageLatencies::Copy, after_read, after_copy);
+	latency_.publish();
+	metricMan->sendMetric("DTC Read Time", artdaq::TimeUtils::GetElapsedTime(before_read, after_read), "s", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Fragment Prep Time", artdaq::TimeUtils::GetElapsedTime(after_read, after_copy), "s", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("HW Timestamp Rate", hw_timestamp_rate, "timestamps/s", 1, artdaq::MetricMode::Average);
+	metricMan->sendMetric("PCIe Transfer Rate", hw_data_rate, "B/s", 1, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Fragment Bytes Copied", bytes_copied, "B", 1, artdaq::MetricMode::Rate);
+	if (rawOutputWriter_)
 	{
-		highest_timestamp_seen_ = fragment_timestamp;
+		metricMan->sendMetric("Raw Output Queue Depth", rawOutputWriter_->queue_depth(), "buffers", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+		metricMan->sendMetric("Raw Output Dropped Events", rawOutputWriter_->dropped(), "events", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Raw Output Write Errors", rawOutputWriter_->write_errors(), "errors", 3, artdaq::MetricMode::LastPoint);
 	}
-	else
+	if (fragmentPool_)
 	{
-		fragment_timestamp += timestamp_loops_ * highest_timestamp_seen_;
-		timestamp_loops_++;
+		metricMan->sendMetric("Fragment Pool Available", fragmentPool_->available(), "Fragments", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Minimum);
+		metricMan->sendMetric("Fragment Pool Misses", fragmentPool_->misses(), "Fragments", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragment Pool Refill Size", fragmentPool_->refillBytes(), "B", 3, artdaq::MetricMode::LastPoint);
 	}
+	ewtSequencer_.sendMetrics();
+
+	TLOG(TLVL_TRACE + 20) << "Returning true";
+
+	return true;
+}
+
+bool mu2e::Mu2eEventReceiverBase::getRequestedDTCFragments(artdaq::FragmentPtrs& frags, std::map<artdaq::Fragment::sequence_id_t, artdaq::Fragment::timestamp_t> const& requests)
+{
+	applyPlacement_();
+
+	if (requests.empty()) return true;
+
+	std::vector<std::pair<artdaq::Fragment::sequence_id_t, artdaq::Fragment::timestamp_t>> pending(requests.begin(), requests.end());
+	std::vector<std::vector<std::unique_ptr<DTCLib::DTC_Event>>> assigned(pending.size());
+	size_t next_pending = 0;
+	size_t reads = 0;
+	size_t unmatched = 0;
 
+	auto before_read = std::chrono::steady_clock::now();
+	readoutWait_.begin();
+	while (next_pending < pending.size())
+	{
+		std::vector<std::unique_ptr<DTCLib::DTC_Event>> data;
+		try
+		{
+			TLOG(TLVL_TRACE + 25) << "Calling theInterface->GetData(" << pending[next_pending].second << ") for " << pending.size() - next_pending << " pending requests";
+			data = theInterface_->GetData(DTCLib::DTC_EventWindowTag(static_cast<uint64_t>(pending[next_pending].second)));
+		}
+		catch (std::exception const& ex)
+		{
+			TLOG(TLVL_ERROR) << "There was an error in the DTC Library: " << ex.what();
+		}
+		if (data.size() == 0)
+		{
+			if (should_stop() || !readoutWait_.next()) break;
+			continue;
+		}
+		++reads;
+
+		bool matched = false;
+		for (auto& evt : data)
+		{
+			auto ewt = evt->GetEventWindowTag().GetEventWindowTag(true);
+			size_t idx = pending.size();
+			for (size_t ii = next_pending; ii < pending.size(); ++ii)
+			{
+				if (pending[ii].second == ewt)
+				{
+					idx = ii;
+					break;
+				}
+			}
+			if (rawOutput_)
+			{
+				rawOutputWriter_->write(evt->GetRawBufferPointer(), evt->GetEventByteCount());
+			}
+			if (idx == pending.size())
+			{
+				// Giving it to an open request would shift every later sequence ID by one
+				TLOG(TLVL_DEBUG) << "Event with EWT " << ewt << " matches no outstanding request; dropping it";
+				ewtSequencer_.unroll(ewt);  // Still counts towards playback loop detection, e.g. when the sim file starts over
+				++unmatched;
+				continue;
+			}
+			if (idx != next_pending)
+			{
+				TLOG(TLVL_TRACE) << "Event with EWT " << ewt << " answers request " << pending[idx].first << " out of order";
+			}
+			assigned[idx].emplace_back(std::move(evt));
+			matched = true;
+			while (next_pending < pending.size() && !assigned[next_pending].empty()) ++next_pending;
+		}
+		// A read that answered nothing counts against the readout wait like an empty one
+		if (!matched && (should_stop() || !readoutWait_.next())) break;
+	}
+	readoutWait_.finish(next_pending == pending.size());
+	auto after_read = std::chrono::steady_clock::now();
+
+	size_t bytes_copied = 0;
+	size_t answered = 0;
+	for (size_t ii = 0; ii < pending.size(); ++ii)
+	{
+		if (assigned[ii].empty()) continue;
+		auto fragment_timestamp = assigned[ii][0]->GetEventWindowTag().GetEventWindowTag(true);
+		if (first_timestamp_seen_ == 0)
+		{
+			first_timestamp_seen_ = fragment_timestamp;
+		}
+		fragment_timestamp = ewtSequencer_.unroll(fragment_timestamp);
+
+		artdaq::FragmentPtrs packed;
+		bytes_copied += packDTCEvents_(assigned[ii], packed, pending[ii].first, fragment_timestamp, fragment_ids_[0]);
+		ewtSequencer_.push(std::move(packed.back()), frags, false);
+		if (ewtSequencer_.dropped()) continue;
+		ev_counter_inc();
+		++answered;
+	}
+	if (answered < pending.size())
+	{
+		ewtSequencer_.flush(frags);
+	}
+	if (answered > 0)
+	{
+		auto after_copy = std::chrono::steady_clock::now();
+		if (unemittedSince_ == std::chrono::steady_clock::time_point()) unemittedSince_ = after_copy;
+		latency_.record(detail::StageLatencies::Read, before_read, after_read);
+		latency_.record(detail::StageLatencies::Copy, after_read, after_copy);
+	}
+	latency_.publish();
+
+	metricMan->sendMetric("Requests per DTC Read", reads > 0 ? static_cast<double>(answered) / reads : 0., "requests", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Unanswered Requests", pending.size() - answered, "requests", 3, artdaq::MetricMode::Accumulate);
+	metricMan->sendMetric("Unmatched DTC Events", unmatched, "events", 3, artdaq::MetricMode::Accumulate);
+	metricMan->sendMetric("Fragment Bytes Copied", bytes_copied, "B", 1, artdaq::MetricMode::Rate);
+	if (fragmentPool_)
+	{
+		metricMan->sendMetric("Fragment Pool Available", fragmentPool_->available(), "Fragments", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Minimum);
+		metricMan->sendMetric("Fragment Pool Misses", fragmentPool_->misses(), "Fragments", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragment Pool Refill Size", fragmentPool_->refillBytes(), "B", 3, artdaq::MetricMode::LastPoint);
+	}
+	ewtSequencer_.sendMetrics();
+
+	// Like getNextDTCFragment: running out of data is only an error when this process drives the CFO
+	return answered == pending.size() || mode_ == 0;
+}
+
+size_t mu2e::Mu2eEventReceiverBase::packDTCEvents_(std::vector<std::unique_ptr<DTCLib::DTC_Event>> const& data, artdaq::FragmentPtrs& frags,
+												   artdaq::Fragment::sequence_id_t seq, artdaq::Fragment::timestamp_t ts, artdaq::Fragment::fragment_id_t fragment_id)
+{
+	size_t bytes_copied = 0;
 	if (data.size() == 1)
 	{
 		TLOG(TLVL_TRACE + 20) << "Creating Fragment, sz=" << data[0]->GetEventByteCount();
-		frags.emplace_back(new artdaq::Fragment(seq_out, fragment_ids_[0], FragmentType::DTCEVT, fragment_timestamp));
-		frags.back()->resizeBytes(data[0]->GetEventByteCount());
-		memcpy(frags.back()->dataBegin(), data[0]->GetRawBufferPointer(), data[0]->GetEventByteCount());
+		if (directFragmentReadout_ || fragmentPool_)
+		{
+			frags.emplace_back(makeDTCEventFragment_(*data[0], seq, ts, fragment_id));
+		}
+		else
+		{
+			frags.emplace_back(new artdaq::Fragment(seq, fragment_id, FragmentType::DTCEVT, ts));
+			frags.back()->resizeBytes(data[0]->GetEventByteCount());
+			memcpy(frags.back()->dataBegin(), data[0]->GetRawBufferPointer(), data[0]->GetEventByteCount());
+		}
+		bytes_copied += data[0]->GetEventByteCount();
 	}
 	else
 	{
 		TLOG(TLVL_TRACE + 20) << "Creating ContainerFragment, sz=" << data.size();
-		frags.emplace_back(new artdaq::Fragment(seq_out, fragment_ids_[0]));
-		frags.back()->setTimestamp(fragment_timestamp);
-		artdaq::ContainerFragmentLoader cfl(*frags.back());
-		cfl.set_missing_data(false);
-
+		std::vector<detail::ContainerFragmentBuilder::Block> blocks;
+		blocks.reserve(data.size());
 		for (auto& evt : data)
 		{
-			TLOG(TLVL_TRACE + 20) << "Creating Fragment, sz=" << data[0]->GetEventByteCount();
-			artdaq::Fragment frag(seq_out, fragment_ids_[0], FragmentType::DTCEVT, fragment_timestamp);
-			frag.resizeBytes(evt->GetEventByteCount());
-			memcpy(frags.back()->dataBegin(), evt->GetRawBufferPointer(), evt->GetEventByteCount());
-			cfl.addFragment(frag);
+			blocks.push_back({evt->GetRawBufferPointer(), evt->GetEventByteCount()});
+			bytes_copied += evt->GetEventByteCount();
+		}
+		frags.emplace_back(detail::ContainerFragmentBuilder::build(blocks, seq, fragment_id, FragmentType::DTCEVT, ts));
+
+		if (verifyContainers_)
+		{
+			auto bad = detail::ContainerFragmentBuilder::verify(*frags.back(), blocks);
+			if (bad != blocks.size())
+			{
+				TLOG(TLVL_ERROR) << "ContainerFragment for sequence ID " << seq << " does not hold event " << bad << " of " << blocks.size()
+								 << "; rebuilding it with ContainerFragmentLoader";
+				metricMan->sendMetric("Container Check Failures", 1, "Fragments", 1, artdaq::MetricMode::Accumulate);
+
+				frags.back().reset(new artdaq::Fragment(seq, fragment_id));
+				frags.back()->setTimestamp(ts);
+				artdaq::ContainerFragmentLoader cfl(*frags.back(), FragmentType::DTCEVT);
+				cfl.set_missing_data(false);
+				artdaq::FragmentPtrs events;
+				for (auto& evt : data)
+				{
+					auto frag = artdaq::Fragment::FragmentBytes(evt->GetEventByteCount());
+					frag->setSequenceID(seq);
+					frag->setFragmentID(fragment_id);
+					frag->setUserType(FragmentType::DTCEVT);
+					frag->setTimestamp(ts);
+					memcpy(frag->dataBeginBytes(), evt->GetRawBufferPointer(), evt->GetEventByteCount());
+					events.push_back(std::move(frag));
+				}
+				cfl.addFragments(events);
+				bytes_copied *= 3;  // Into the container, into each event Fragment, then again by addFragments
+			}
 		}
 	}
 
-	auto after_copy = std::chrono::steady_clock::now();
-	TLOG(TLVL_TRACE + 20) << "Incrementing event counter";
-	ev_counter_inc();
+	return bytes_copied;
+}
 
-	TLOG(TLVL_TRACE + 20) << "Reporting Metrics";
-	auto hwTime = theInterface_->GetDevice()->GetDeviceTime();
+artdaq::FragmentPtr mu2e::Mu2eEventReceiverBase::makeDTCEventFragment_(DTCLib::DTC_Event const& evt, artdaq::Fragment::sequence_id_t seq, artdaq::Fragment::timestamp_t ts,
+																	   artdaq::Fragment::fragment_id_t fragment_id)
+{
+	// A single allocation at the final payload size; the only copy is out of the DMA buffer, which DTCLib keeps ownership of
+	auto frag = fragmentPool_ ? fragmentPool_->take(evt.GetEventByteCount()) : artdaq::Fragment::FragmentBytes(evt.GetEventByteCount());
+	frag->setSequenceID(seq);
+	frag->setFragmentID(fragment_id);
+	frag->setUserType(FragmentType::DTCEVT);
+	frag->setTimestamp(ts);
+	memcpy(frag->dataBeginBytes(), evt.GetRawBufferPointer(), evt.GetEventByteCount());
+	return frag;
+}
 
-	double hw_timestamp_rate = 1 / hwTime;
-	double hw_data_rate = frags.back()->sizeBytes() / hwTime;
+bool mu2e::Mu2eEventReceiverBase::drainPrefetcher_(artdaq::FragmentPtrs& frags)
+{
+	std::chrono::steady_clock::time_point oldest;
+	auto frags_before = frags.size();
+	auto ret = prefetcher_->drain(frags, std::chrono::milliseconds(100), &oldest);
+	if (frags.size() > frags_before)
+	{
+		latency_.record(detail::StageLatencies::Emit, std::chrono::steady_clock::now() - oldest);
+	}
+	metricMan->sendMetric("Prefetch Ring Depth", prefetcher_->depth(), "Fragments", 3, artdaq::MetricMode::LastPoint);
+	metricMan->sendMetric("Prefetch Ring Fill", prefetcher_->fill(), "Fragments", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+	return ret;
+}
 
-	metricMan->sendMetric("DTC Read Time", artdaq::TimeUtils::GetElapsedTime(after_read, after_copy), "s", 3, artdaq::MetricMode::Average);
-	metricMan->sendMetric("Fragment Prep Time", artdaq::TimeUtils::GetElapsedTime(before_read, after_read), "s", 3, artdaq::MetricMode::Average);
-	metricMan->sendMetric("HW Timestamp Rate", hw_timestamp_rate, "timestamps/s", 1, artdaq::MetricMode::Average);
-	metricMan->sendMetric("PCIe Transfer Rate", hw_data_rate, "B/s", 1, artdaq::MetricMode::Average);
+void mu2e::Mu2eEventReceiverBase::recordEmit_(artdaq::FragmentPtrs const& frags)
+{
+	if (frags.empty() || unemittedSince_ == std::chrono::steady_clock::time_point()) return;
+	latency_.record(detail::StageLatencies::Emit, unemittedSince_, std::chrono::steady_clock::now());
+	unemittedSince_ = {};
+}
 
-	TLOG(TLVL_TRACE + 20) << "Returning true";
+void mu2e::Mu2eEventReceiverBase::applyPlacement_()
+{
+	if (placementApplied_) return;
+	if (!placement_.apply())
+	{
+		TLOG(TLVL_WARNING) << "Could not apply readout placement (" << placement_.describe() << ")";
+	}
+	placementApplied_ = true;
+}
 
+bool mu2e::Mu2eEventReceiverBase::readCard_(DTCCard& card, artdaq::FragmentPtrs& frags)
+{
+	if (!card.placed)
+	{
+		if (!card.placement.apply())
+		{
+			TLOG(TLVL_WARNING) << "Could not apply readout placement (" << card.placement.describe() << ") for DTC " << card.dtc_id;
+		}
+		card.placed = true;
+	}
+
+	if (card.simUpload ? !card.simUpload->wait([this]() { return should_stop(); }) : !waitForSimFile_())
+	{
+		return false;
+	}
+	if (!card.pacer.acquire(1, [&]() { return should_stop(); }) || should_stop())
+	{
+		return false;
+	}
+
+	// Every card reads the same sequence of event windows, so the sequence IDs line up across fragment IDs
+	artdaq::Fragment::sequence_id_t seq = (card.windows_read * n_dtcs_) + dtc_offset_ + 1;
+	auto before_request = std::chrono::steady_clock::now();
+	if (card.cfo != nullptr)
+	{
+		DTCLib::DTC_EventWindowTag tag(card.first_timestamp_seen > 0 ? seq + card.first_timestamp_seen : uint64_t(0));
+		TLOG_DEBUG(2) << "Sending request for timestamp " << tag.GetEventWindowTag(true) << " to DTC " << card.dtc_id;
+		card.cfo->SendRequestForTimestamp(tag, heartbeats_after_);
+	}
+
+	uint64_t z = 0;
+	DTCLib::DTC_EventWindowTag zero(z);
+	std::vector<std::unique_ptr<DTCLib::DTC_Event>> data;
+	auto before_read = std::chrono::steady_clock::now();
+	card.wait.begin();
+	do
+	{
+		try
+		{
+			data = card.dtc->GetData(zero);
+		}
+		catch (std::exception const& ex)
+		{
+			TLOG(TLVL_ERROR) << "There was an error in the DTC Library reading DTC " << card.dtc_id << ": " << ex.what();
+		}
+	} while (data.size() == 0 && !should_stop() && card.wait.next());
+	card.wait.finish(data.size() > 0);
+	if (data.size() == 0)
+	{
+		card.sequencer.flush(frags);
+		return mode_ == 0;
+	}
+	auto after_read = std::chrono::steady_clock::now();
+	if (card.cfo != nullptr)
+	{
+		latency_.record(detail::StageLatencies::RequestToData, before_request, after_read);
+	}
+
+	auto fragment_timestamp = data[0]->GetEventWindowTag().GetEventWindowTag(true);
+	if (card.first_timestamp_seen == 0)
+	{
+		card.first_timestamp_seen = fragment_timestamp;
+	}
+	fragment_timestamp = card.sequencer.unroll(fragment_timestamp);
+
+	size_t bytes_copied = 0;
+	{
+		// The Fragment pool and the raw output writer each expect a single caller
+		std::unique_lock<std::mutex> lk(cardSharedMutex_);
+		if (rawOutputWriter_)
+		{
+			for (auto& evt : data)
+			{
+				rawOutputWriter_->write(evt->GetRawBufferPointer(), evt->GetEventByteCount());
+			}
+		}
+		artdaq::FragmentPtrs packed;
+		bytes_copied = packDTCEvents_(data, packed, seq, fragment_timestamp, card.fragment_id);
+		card.sequencer.push(std::move(packed.back()), frags);
+	}
+	latency_.record(detail::StageLatencies::Read, before_read, after_read);
+	latency_.record(detail::StageLatencies::Copy, after_read, std::chrono::steady_clock::now());
+	if (!card.sequencer.dropped()) ++card.windows_read;
+
+	metricMan->sendMetric("DTC " + std::to_string(card.dtc_id) + " Windows Read", card.windows_read.load(), "windows", 3, artdaq::MetricMode::LastPoint);
+	card.sequencer.sendMetrics("DTC " + std::to_string(card.dtc_id) + " ");
+	metricMan->sendMetric("Fragment Bytes Copied", bytes_copied, "B", 1, artdaq::MetricMode::Rate);
 	return true;
 }
 
+bool mu2e::Mu2eEventReceiverBase::drainCards_(artdaq::FragmentPtrs& frags)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+	bool running = true;
+	do
+	{
+		// Keep going while any card is still reading or holds Fragments; the others may finish first after a stop
+		running = false;
+		for (auto& card : cards_)
+		{
+			std::chrono::steady_clock::time_point oldest;
+			auto frags_before = frags.size();
+			running |= card->reader.drain(frags, std::chrono::microseconds(0), &oldest);
+			if (frags.size() > frags_before)
+			{
+				latency_.record(detail::StageLatencies::Emit, std::chrono::steady_clock::now() - oldest);
+			}
+		}
+		if (!frags.empty() || !running) break;
+		std::this_thread::sleep_for(std::chrono::microseconds(20));
+	} while (std::chrono::steady_clock::now() < deadline);
+
+	// An event window is complete once every card has delivered its Fragment for it
+	size_t complete = cards_.front()->windows_read;
+	for (auto& card : cards_)
+	{
+		complete = std::min(complete, card->windows_read.load());
+	}
+	while (ev_counter() - 1 < complete)
+	{
+		ev_counter_inc();
+	}
+
+	size_t fill = 0;
+	for (auto& card : cards_) fill = std::max(fill, card->reader.fill());
+	metricMan->sendMetric("DTC Card Ring Fill", fill, "Fragments", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+	latency_.publish();
+	return running;
+}
+
 size_t mu2e::Mu2eEventReceiverBase::getCurrentSequenceID()
 {
 	return ((ev_counter()-1) * n_dtcs_) + dtc_offset_ + 1;
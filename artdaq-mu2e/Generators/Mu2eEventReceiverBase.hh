@@ -24,16 +24,30 @@
 #include "fhiclcpp/fwd.h"
 
 #include <atomic>
+#include <map>
+#include <mutex>
 #include <vector>
 
 #include "dtcInterfaceLib/DTC.h"
 #include "dtcInterfaceLib/DTCSoftwareCFO.h"
 
+#include "artdaq-mu2e/Generators/detail/EWTSequencer.hh"
+#include "artdaq-mu2e/Generators/detail/FragmentPool.hh"
+#include "artdaq-mu2e/Generators/detail/FragmentPrefetcher.hh"
+#include "artdaq-mu2e/Generators/detail/LatencyHistogram.hh"
+#include "artdaq-mu2e/Generators/detail/RawOutputWriter.hh"
+#include "artdaq-mu2e/Generators/detail/ReadoutWaitStrategy.hh"
+#include "artdaq-mu2e/Generators/detail/RequestPacer.hh"
+#include "artdaq-mu2e/Generators/detail/SimFileUpload.hh"
+#include "artdaq-mu2e/Generators/detail/ThreadPlacement.hh"
+
 namespace mu2e {
 class Mu2eEventReceiverBase : public artdaq::CommandableFragmentGenerator
 {
 public:
-	explicit Mu2eEventReceiverBase(fhicl::ParameterSet const& ps);
+	// open_dtc = false leaves theInterface_ and theCFO_ null, for generators whose events come from software.
+	// multi_card: the generator reads cards_ through drainCards_; otherwise a dtc_ids list is rejected.
+	explicit Mu2eEventReceiverBase(fhicl::ParameterSet const& ps, bool open_dtc = true, bool multi_card = false);
 	virtual ~Mu2eEventReceiverBase();
 
 	DTCLib::DTC_SimMode GetMode() { return mode_; }
@@ -41,16 +55,70 @@ public:
 protected:
   bool getNextDTCFragment(artdaq::FragmentPtrs& output, DTCLib::DTC_EventWindowTag ts, artdaq::Fragment::sequence_id_t seq_in = 0);
 
+	// Service a batch of requests (sequence ID -> Event Window Tag) from shared DTC reads: each event is given to the
+	// request with its EWT, or to the oldest open request if none matches, so one read can answer several requests
+	bool getRequestedDTCFragments(artdaq::FragmentPtrs& output, std::map<artdaq::Fragment::sequence_id_t, artdaq::Fragment::timestamp_t> const& requests);
+
 	void start() override;
 
 	void stopNoMutex() override {}
 
 	void stop() override;
 
-	void readSimFile_(std::string sim_file);
+	// Block until the simulation file is in DTC memory; returns false if the generator is stopped first
+	bool waitForSimFile_();
 
 	size_t getCurrentSequenceID();
 
+	// Allocate a DTCEVT Fragment at its final size and copy the event into it directly from the DTC buffer
+	artdaq::FragmentPtr makeDTCEventFragment_(DTCLib::DTC_Event const& evt, artdaq::Fragment::sequence_id_t seq, artdaq::Fragment::timestamp_t ts,
+											  artdaq::Fragment::fragment_id_t fragment_id);
+
+	// Turn the events from one GetData call into a DTCEVT Fragment (or a ContainerFragment of them); returns the bytes copied
+	size_t packDTCEvents_(std::vector<std::unique_ptr<DTCLib::DTC_Event>> const& data, artdaq::FragmentPtrs& output,
+						  artdaq::Fragment::sequence_id_t seq, artdaq::Fragment::timestamp_t ts, artdaq::Fragment::fragment_id_t fragment_id);
+
+	// Hand the Fragments already read by the prefetch thread to artdaq (prefetch_ring_depth > 0)
+	bool drainPrefetcher_(artdaq::FragmentPtrs& output);
+
+	// getNext_ is about to return output: record how long its oldest Fragment waited since it was built
+	void recordEmit_(artdaq::FragmentPtrs const& output);
+
+	// One DTC card when dtc_ids lists more than one. Card 0 uses theInterface_ and theCFO_;
+	// each card is read by its own thread and tags its Fragments with its own fragment ID.
+	struct DTCCard
+	{
+		DTCCard(size_t ring_depth, fhicl::ParameterSet const& ps, float request_rate, size_t burst)
+			: reader(ring_depth), wait(ps), pacer(request_rate, burst), sequencer(ps) {}
+
+		int dtc_id{-1};
+		artdaq::Fragment::fragment_id_t fragment_id{0};
+		detail::ThreadPlacement placement;
+		DTCLib::DTC* dtc{nullptr};
+		DTCLib::DTCSoftwareCFO* cfo{nullptr};
+		std::unique_ptr<DTCLib::DTC> ownedInterface;
+		std::unique_ptr<DTCLib::DTCSoftwareCFO> ownedCFO;
+		std::unique_ptr<detail::SimFileUpload> simUpload;  // Cards after the first; card 0 uses simFileUpload_
+		bool placed{false};
+		std::atomic<size_t> windows_read{0};
+		size_t first_timestamp_seen{0};
+		detail::FragmentPrefetcher reader;
+		detail::ReadoutWaitStrategy wait;
+		detail::RequestPacer pacer;
+		detail::EWTSequencer sequencer;
+	};
+
+	// Request (in simulation mode) and read one event window from a card; runs on the card's reader thread
+	bool readCard_(DTCCard& card, artdaq::FragmentPtrs& output);
+
+	// Collect the Fragments every card has read so far and advance ev_counter() past the windows all cards have delivered
+	bool drainCards_(artdaq::FragmentPtrs& output);
+
+	// Pin the calling thread and set its memory policy per readout_cpus/readout_numa_node, once per run
+	void applyPlacement_();
+
+	std::unique_ptr<DTCLib::DTCSoftwareCFO> makeCFO_(DTCLib::DTC* dtc, fhicl::ParameterSet const& ps);
+
 
 	// Like "getNext_", "fragmentIDs_" is a mandatory override; it
 	// returns a vector of the fragment IDs an instance of this class
@@ -63,16 +131,16 @@ protected:
 	std::vector<artdaq::Fragment::fragment_id_t> fragment_ids_;
 
 	// State
-	size_t highest_timestamp_seen_{0};
-	size_t timestamp_loops_{0};  // For playback mode, so that we continually generate unique timestamps
 	DTCLib::DTC_SimMode mode_;
-	bool simFileRead_;
 	const bool skip_dtc_init_;
 	bool rawOutput_{false};
 	std::string rawOutputFile_{""};
-	std::ofstream rawOutputStream_;
+	detail::RawOutputWriter::Config rawOutputConfig_;
+	std::unique_ptr<detail::RawOutputWriter> rawOutputWriter_;  // Created at start() when raw_output_enable is set
 	bool print_packets_;
 	size_t heartbeats_after_{16};
+	bool directFragmentReadout_{false};  // Skip the resizeBytes path and build Fragments at their final size
+	bool verifyContainers_{true};        // Check each multi-event ContainerFragment against the events it was built from
 
 	size_t dtc_offset_{0};
 	size_t n_dtcs_{1};
@@ -80,13 +148,23 @@ protected:
 
 	std::unique_ptr<DTCLib::DTC> theInterface_;
 	std::unique_ptr<DTCLib::DTCSoftwareCFO> theCFO_;
+	std::unique_ptr<detail::SimFileUpload> simFileUpload_;  // Null unless a sim file is being loaded; joined before theInterface_ goes away
+	std::unique_ptr<detail::FragmentPrefetcher> prefetcher_;  // Null unless prefetch_ring_depth > 0
+	std::unique_ptr<detail::FragmentPool> fragmentPool_;      // Null unless fragment_pool_size > 0
+	std::vector<std::unique_ptr<DTCCard>> cards_;             // Empty unless dtc_ids has more than one entry
+	std::mutex cardSharedMutex_;                                // Serializes card threads on fragmentPool_ and rawOutputWriter_
+	detail::ThreadPlacement placement_;  // Readout thread placement for the single-card path
+	bool placementApplied_{false};
 
         float                   request_rate_;
-        std::condition_variable throttle_cv_;
-	std::mutex              throttle_mutex_;
+        detail::RequestPacer    pacer_;  // Paces CFO requests to request_rate_
         int                     diagLevel_;
         int                     frag_sent_;
-        std::chrono::time_point<std::chrono::steady_clock> sending_start_;
+
+	detail::ReadoutWaitStrategy readoutWait_;  // Spin/yield/sleep policy for empty GetData calls
+	detail::EWTSequencer ewtSequencer_;        // Timestamp unrolling and EWT-ordered release of Fragments
+	detail::StageLatencies latency_;           // Request, read, copy and emit latency histograms; record() is thread-safe
+	std::chrono::steady_clock::time_point unemittedSince_{};  // When the oldest Fragment not yet returned by getNext_ was built
 
 };
 }  // namespace mu2e
@@ -2,6 +2,7 @@
 // It can be used as an exmaple for developing more specific functionality.
 
 #include "artdaq-mu2e/Generators/Mu2eEventReceiverBase.hh"
+#include "artdaq-mu2e/Generators/detail/RequestPipeline.hh"
 
 #include "artdaq/Generators/GeneratorMacros.hh"
 
@@ -21,13 +22,27 @@ private:
 	// getNext_ function declared in CommandableFragmentGenerator
 
 	bool getNext_(artdaq::FragmentPtrs& output) override;
-	DTCLib::DTC_EventWindowTag getCurrentEventWindowTag();
+	DTCLib::DTC_EventWindowTag getCurrentEventWindowTag(size_t windows_ahead = 0);
+
+	// Request and read a batch of event windows; runs on the prefetch thread when prefetch_ring_depth > 0
+	bool readEventWindow_(artdaq::FragmentPtrs& output);
+
+	void start() override;
+
+	size_t max_windows_per_call_{1};  // Batch size for CFO requests and reads in one getNext_
+	bool adaptive_batch_{false};      // Grow the batch while every window returns data, shrink it when one does not
+	size_t windows_per_call_{1};
+	detail::RequestPipeline requestPipeline_;  // requests_in_flight windows requested ahead of readout
 };
 }  // namespace mu2e
 
 mu2e::Mu2eEventReceiver::Mu2eEventReceiver(fhicl::ParameterSet const& ps)
-  : Mu2eEventReceiverBase(ps)
+  : Mu2eEventReceiverBase(ps, true, true)
+  , max_windows_per_call_(std::max(ps.get<size_t>("event_windows_per_call", 1), size_t(1)))
+  , adaptive_batch_(ps.get<bool>("adaptive_event_windows_per_call", false))
+  , requestPipeline_(ps)
 {
+	windows_per_call_ = adaptive_batch_ ? 1 : max_windows_per_call_;
 	TLOG(TLVL_DEBUG) << "Mu2eEventReceiver Initialized with mode " << mode_;
 }
 
@@ -35,31 +50,59 @@ mu2e::Mu2eEventReceiver::~Mu2eEventReceiver()
 {
 }
 
+void mu2e::Mu2eEventReceiver::start()
+{
+	Mu2eEventReceiverBase::start();
+	requestPipeline_.reset();
+	if (prefetcher_)
+	{
+		prefetcher_->start([this](artdaq::FragmentPtrs& frags) { return readEventWindow_(frags); });
+	}
+}
+
 bool mu2e::Mu2eEventReceiver::getNext_(artdaq::FragmentPtrs& frags)
 {
-	while (!simFileRead_ && !should_stop())
+	if (!cards_.empty())
+	{
+		return drainCards_(frags);
+	}
+	if (prefetcher_)
+	{
+		return drainPrefetcher_(frags);
+	}
+	auto ret = readEventWindow_(frags);
+	recordEmit_(frags);
+	return ret;
+}
+
+bool mu2e::Mu2eEventReceiver::readEventWindow_(artdaq::FragmentPtrs& frags)
+{
+	if (!waitForSimFile_())
+	{
+		return false;
+	}
+
+	// The first window has to be read alone; it sets first_timestamp_seen_, which the following tags are computed from
+	size_t n_windows = first_timestamp_seen_ > 0 ? windows_per_call_ : 1;
+
+	// Windows consumed so far; window w is requested with the tag of sequence ID (w * n_dtcs_) + dtc_offset_ + 1
+	uint64_t read = ev_counter() - 1;
+	size_t n_requests = n_windows;
+	if (mode_ != 0)
 	{
-		usleep(5000);
+		// Top up the requests in flight; the whole batch is always requested before it is read
+		n_requests = first_timestamp_seen_ > 0 ? requestPipeline_.toIssue(read, n_windows) : (requestPipeline_.inFlight(read) > 0 ? 0 : 1);
 	}
 
-	std::unique_lock<std::mutex> throttle_lock(throttle_mutex_);
-	auto throttle_usecs = 1000000 / request_rate_;
-	TLOG(TLVL_INFO) << "[mu2e::Mu2eEventReceiver::getNext_] request_rate= " << request_rate_
-			<< " wait_time= " << throttle_usecs;
-	throttle_cv_.wait_for(throttle_lock, std::chrono::microseconds(static_cast<int>( throttle_usecs)), [&]() { return should_stop(); });
-
-	// if (frag_sent_ == 0) 
-        // {
-	//         sending_start_ = std::chrono::steady_clock::now();
-	// }
-
-	// auto target = sending_start_ + std::chrono::microseconds(static_cast<int>((frag_sent_+1) * 1000000 / request_rate_));
-	// auto now    = std::chrono::steady_clock::now();
-	// if ((now < target))
-	// {
-	//         std::this_thread::sleep_until(target);
-	// }
-	
+	TLOG(TLVL_TRACE + 21) << "[mu2e::Mu2eEventReceiver::getNext_] request_rate= " << request_rate_ << " windows= " << n_windows << " requests= " << n_requests;
+	if (n_requests > 0 && !pacer_.acquire(n_requests, [&]() { return should_stop(); }))
+	{
+		return false;
+	}
+	if (pacer_.enabled())
+	{
+		metricMan->sendMetric("Achieved Request Rate", pacer_.achievedRate(), "Hz", 3, artdaq::MetricMode::LastPoint);
+	}
 
 	if (should_stop())
 	{
@@ -71,19 +114,62 @@ bool mu2e::Mu2eEventReceiver::getNext_(artdaq::FragmentPtrs& frags)
 
 	if (mode_ != 0)
 	{
-	        TLOG_DEBUG(2) << "Sending request for timestamp " << getCurrentEventWindowTag().GetEventWindowTag(true);
-		theCFO_->SendRequestForTimestamp(getCurrentEventWindowTag(), heartbeats_after_);
+		// The DTC works on the windows ahead while the current one is copied out
+		for (size_t ii = 0; ii < n_requests; ++ii)
+		{
+			auto tag = getCurrentEventWindowTag(requestPipeline_.next() + ii - read);
+			TLOG_DEBUG(2) << "Sending request for timestamp " << tag.GetEventWindowTag(true);
+			theCFO_->SendRequestForTimestamp(tag, heartbeats_after_);
+		}
+		requestPipeline_.issued(n_requests);
+		metricMan->sendMetric("Requests In Flight", requestPipeline_.inFlight(read), "windows", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+		metricMan->sendMetric("Estimated DMA Occupancy", requestPipeline_.estimatedOccupancyBytes(read), "Bytes", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+	}
+
+	// Windows read are counted from ev_counter(): with ewt_reorder_window set, Fragments can be held back by the sequencer.
+	// The window size estimate uses the Fragments released, one per window.
+	size_t frags_before = frags.size();
+	for (size_t ii = 0; ii < n_windows; ++ii)
+	{
+		++frag_sent_;
+		if (!getNextDTCFragment(frags, zero))
+		{
+			requestPipeline_.abandon(ev_counter() - 1);
+			return false;
+		}
+		requestPipeline_.completed(ev_counter() - 1, [this](auto latency) { latency_.record(detail::StageLatencies::RequestToData, latency); });
+	}
+	size_t windows_read = ev_counter() - 1 - read;
+	size_t bytes_released = 0;
+	for (auto it = std::next(frags.begin(), frags_before); it != frags.end(); ++it) bytes_released += (*it)->sizeBytes();
+	requestPipeline_.received(frags.size() - frags_before, bytes_released);
+	if (windows_read == 0)
+	{
+		// Readout came back empty, so the outstanding requests are sent again from the current window
+		requestPipeline_.abandon(ev_counter() - 1);
+	}
+
+	if (adaptive_batch_)
+	{
+		if (windows_read == n_windows)
+		{
+			windows_per_call_ = std::min(windows_per_call_ * 2, max_windows_per_call_);
+		}
+		else
+		{
+			windows_per_call_ = std::max(windows_per_call_ / 2, size_t(1));
+		}
+		metricMan->sendMetric("Event Windows per Call", windows_per_call_, "windows", 3, artdaq::MetricMode::Average);
 	}
 
-	++frag_sent_;
-	return getNextDTCFragment(frags, zero);
+	return true;
 }
 
-DTCLib::DTC_EventWindowTag mu2e::Mu2eEventReceiver::getCurrentEventWindowTag()
+DTCLib::DTC_EventWindowTag mu2e::Mu2eEventReceiver::getCurrentEventWindowTag(size_t windows_ahead)
 {
 	if(first_timestamp_seen_ > 0) 
 	{
-		return DTCLib::DTC_EventWindowTag(getCurrentSequenceID() + first_timestamp_seen_);
+		return DTCLib::DTC_EventWindowTag(getCurrentSequenceID() + windows_ahead * n_dtcs_ + first_timestamp_seen_);
 	}
 
 	return DTCLib::DTC_EventWindowTag(uint64_t(0));
@@ -5,6 +5,18 @@
 #include "dtcInterfaceLib/DTC.h"
 #include "dtcInterfaceLib/DTCSoftwareCFO.h"
 
+#include "artdaq-mu2e/Generators/detail/EWTSequencer.hh"
+#include "artdaq-mu2e/Generators/detail/FragmentPool.hh"
+#include "artdaq-mu2e/Generators/detail/FragmentPrefetcher.hh"
+#include "artdaq-mu2e/Generators/detail/LatencyHistogram.hh"
+#include "artdaq-mu2e/Generators/detail/LinkMetricsPublisher.hh"
+#include "artdaq-mu2e/Generators/detail/RawOutputWriter.hh"
+#include "artdaq-mu2e/Generators/detail/ReadoutWaitStrategy.hh"
+#include "artdaq-mu2e/Generators/detail/RequestPacer.hh"
+#include "artdaq-mu2e/Generators/detail/RequestPipeline.hh"
+#include "artdaq-mu2e/Generators/detail/SimFileUpload.hh"
+#include "artdaq-mu2e/Generators/detail/ThreadPlacement.hh"
+
 #include "artdaq-core/Data/ContainerFragmentLoader.hh"
 #include "artdaq-core/Data/MetadataFragment.hh"
 #include "artdaq/DAQdata/Globals.hh"
@@ -33,7 +45,6 @@ private:
 
 	void stop() override;
 
-	void readSimFile_(std::string sim_file);
 
 	size_t getCurrentSequenceID();
 
@@ -48,14 +59,12 @@ private:
 	std::vector<artdaq::Fragment::fragment_id_t> fragment_ids_;
 
 	// State
-	size_t highest_timestamp_seen_{0};
-	size_t timestamp_loops_{0};  // For playback mode, so that we continually generate unique timestamps
 	DTCLib::DTC_SimMode mode_;
-  bool simFileRead_{true};
 	const bool skip_dtc_init_;
 	bool rawOutput_{false};
 	std::string rawOutputFile_{""};
-	std::ofstream rawOutputStream_;
+	detail::RawOutputWriter::Config rawOutputConfig_;
+	std::unique_ptr<detail::RawOutputWriter> rawOutputWriter_;  // Created at start() when raw_output_enable is set
 	bool print_packets_;
 	size_t heartbeats_after_{16};
 
@@ -65,18 +74,32 @@ private:
 
 	std::unique_ptr<DTCLib::DTC> theInterface_;
 	std::unique_ptr<DTCLib::DTCSoftwareCFO> theCFO_;
+	std::unique_ptr<detail::SimFileUpload> simFileUpload_;  // Null unless a sim file is being loaded; joined before theInterface_ goes away
+	std::unique_ptr<detail::FragmentPrefetcher> prefetcher_;  // Null unless prefetch_ring_depth > 0
+	std::unique_ptr<detail::FragmentPool> fragmentPool_;      // Null unless fragment_pool_size > 0
 
 	std::size_t const throttle_usecs_;
         std::size_t const rollover_subrun_interval_;
-	std::condition_variable throttle_cv_;
-	std::mutex throttle_mutex_;
+	detail::RequestPacer pacer_;  // One request every throttle_usecs_
+	detail::RequestPipeline requestPipeline_;  // requests_in_flight windows requested ahead of readout
 	int diagLevel_;
+	detail::LinkMetricsPublisher linkMetrics_;  // Link status/latency and per-ROC metrics, published every linkMetricsInterval_
+	std::chrono::milliseconds linkMetricsInterval_;
+	detail::ReadoutWaitStrategy readoutWait_;  // Spin/yield/sleep policy for empty GetSubEventData calls
+	detail::ThreadPlacement placement_;        // readout_cpus/readout_numa_node for the readout thread
+	bool placementApplied_{false};
+	detail::EWTSequencer ewtSequencer_;        // Timestamp unrolling and EWT-ordered release of Fragments
+	detail::StageLatencies latency_;           // Request, read, copy and emit latency histograms; record() is thread-safe
+	std::chrono::steady_clock::time_point unemittedSince_{};  // When the oldest Fragment not yet returned by getNext_ was built
 	// The "getNext_" function is used to implement user-specific
 	// functionality; it's a mandatory override of the pure virtual
 	// getNext_ function declared in CommandableFragmentGenerator
 
 	bool getNext_(artdaq::FragmentPtrs& output) override;
-	DTCLib::DTC_EventWindowTag getCurrentEventWindowTag();
+	DTCLib::DTC_EventWindowTag getCurrentEventWindowTag(size_t windows_ahead = 0);
+
+	// Request and read one event window; runs on the prefetch thread when prefetch_ring_depth > 0
+	bool readEventWindow_(artdaq::FragmentPtrs& output);
 };
 }  // namespace mu2e
 
@@ -86,14 +109,52 @@ mu2e::Mu2eSubEventReceiver::~Mu2eSubEventReceiver()
 
 bool mu2e::Mu2eSubEventReceiver::getNext_(artdaq::FragmentPtrs& frags)
 {
-	while (!simFileRead_ && !should_stop())
+	if (prefetcher_)
+	{
+		std::chrono::steady_clock::time_point oldest;
+		auto frags_before = frags.size();
+		auto ret = prefetcher_->drain(frags, std::chrono::milliseconds(100), &oldest);
+		if (frags.size() > frags_before)
+		{
+			latency_.record(detail::StageLatencies::Emit, std::chrono::steady_clock::now() - oldest);
+		}
+		metricMan->sendMetric("Prefetch Ring Depth", prefetcher_->depth(), "Fragments", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Prefetch Ring Fill", prefetcher_->fill(), "Fragments", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+		return ret;
+	}
+
+	auto ret = readEventWindow_(frags);
+	if (!frags.empty() && unemittedSince_ != std::chrono::steady_clock::time_point())
+	{
+		latency_.record(detail::StageLatencies::Emit, unemittedSince_, std::chrono::steady_clock::now());
+		unemittedSince_ = {};
+	}
+	return ret;
+}
+
+bool mu2e::Mu2eSubEventReceiver::readEventWindow_(artdaq::FragmentPtrs& frags)
+{
+	if (simFileUpload_ && !simFileUpload_->wait([this]() { return should_stop(); }))
 	{
-		usleep(5000);
+		return false;
 	}
 
-	if(throttle_usecs_ > 0) {
-	  std::unique_lock<std::mutex> throttle_lock(throttle_mutex_);
-	  throttle_cv_.wait_for(throttle_lock, std::chrono::microseconds(throttle_usecs_), [&]() { return should_stop(); });
+	// Windows consumed so far; each sub-event read advances ev_counter() by one
+	uint64_t read = ev_counter() - 1;
+	size_t n_requests = 1;
+	if (mode_ != DTCLib::DTC_SimMode_Disabled)
+	{
+		// The first window sets first_timestamp_seen_, so it is requested (with tag 0) and read alone
+		n_requests = first_timestamp_seen_ > 0 ? requestPipeline_.toIssue(read) : (requestPipeline_.inFlight(read) > 0 ? 0 : 1);
+	}
+
+	if (n_requests > 0 && !pacer_.acquire(n_requests, [&]() { return should_stop(); }))
+	{
+		return false;
+	}
+	if (pacer_.enabled())
+	{
+		metricMan->sendMetric("Achieved Request Rate", pacer_.achievedRate(), "Hz", 3, artdaq::MetricMode::LastPoint);
 	}
 
 	if (should_stop())
@@ -106,8 +167,16 @@ bool mu2e::Mu2eSubEventReceiver::getNext_(artdaq::FragmentPtrs& frags)
 
 	if (mode_ != DTCLib::DTC_SimMode_Disabled)
 	{
-		if (diagLevel_ > 0) TLOG(TLVL_INFO) << "Sending request for timestamp " << getCurrentEventWindowTag().GetEventWindowTag(true);
-		theCFO_->SendRequestForTimestamp(getCurrentEventWindowTag(), heartbeats_after_);
+		// The DTC works on the windows ahead while the current one is copied out
+		for (size_t ii = 0; ii < n_requests; ++ii)
+		{
+			auto tag = getCurrentEventWindowTag(requestPipeline_.next() + ii - read);
+			if (diagLevel_ > 0) TLOG(TLVL_INFO) << "Sending request for timestamp " << tag.GetEventWindowTag(true);
+			theCFO_->SendRequestForTimestamp(tag, heartbeats_after_);
+		}
+		requestPipeline_.issued(n_requests);
+		metricMan->sendMetric("Requests In Flight", requestPipeline_.inFlight(read), "windows", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+		metricMan->sendMetric("Estimated DMA Occupancy", requestPipeline_.estimatedOccupancyBytes(read), "Bytes", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
 	}
 
 	//--------------------------------------------------------------------------------
@@ -119,14 +188,30 @@ bool mu2e::Mu2eSubEventReceiver::getNext_(artdaq::FragmentPtrs& frags)
 	  frags.emplace_back(std::move(endOfSubrunFrag));
 	}
 	
-	return getNextDTCFragment(frags, zero);
+	auto frags_before = frags.size();
+	auto ret = getNextDTCFragment(frags, zero);
+
+	uint64_t windows_read = ev_counter() - 1 - read;
+	requestPipeline_.completed(ev_counter() - 1, [this](auto latency) { latency_.record(detail::StageLatencies::RequestToData, latency); });
+	if (windows_read == 0)
+	{
+		// Readout came back empty, so the outstanding requests are sent again from the current window
+		requestPipeline_.abandon(read);
+	}
+	else
+	{
+		size_t bytes_read = 0;
+		for (auto it = std::next(frags.begin(), frags_before); it != frags.end(); ++it) bytes_read += (*it)->sizeBytes();
+		requestPipeline_.received(windows_read, bytes_read);
+	}
+	return ret;
 }
 
-DTCLib::DTC_EventWindowTag mu2e::Mu2eSubEventReceiver::getCurrentEventWindowTag()
+DTCLib::DTC_EventWindowTag mu2e::Mu2eSubEventReceiver::getCurrentEventWindowTag(size_t windows_ahead)
 {
 	if (first_timestamp_seen_ > 0)
 	{
-		return DTCLib::DTC_EventWindowTag(getCurrentSequenceID() + first_timestamp_seen_);
+		return DTCLib::DTC_EventWindowTag(getCurrentSequenceID() + windows_ahead + first_timestamp_seen_);
 	}
 
 	return DTCLib::DTC_EventWindowTag(uint64_t(0));
@@ -145,7 +230,14 @@ mu2e::Mu2eSubEventReceiver::Mu2eSubEventReceiver(fhicl::ParameterSet const& ps)
 	, n_dtcs_                  (ps.get<size_t>     ("n_dtcs_in_chain", 1))
 	, throttle_usecs_          (ps.get<size_t>     ("throttle_usecs", 0))  // in units of us
 	, rollover_subrun_interval_(ps.get<size_t>     ("rollover_subrun_interval", 20000))
+	, pacer_                   (throttle_usecs_ > 0 ? 1e6 / throttle_usecs_ : 0, ps.get<size_t>("request_burst", 1))
+	, requestPipeline_         (ps)
 	, diagLevel_               (ps.get<int>        ("diagLevel", 0))
+	, linkMetricsInterval_     (ps.get<size_t>     ("link_metrics_interval_ms", 1000))
+	, readoutWait_             (ps)
+	, placement_               (ps, ps.get<int>("dtc_id", -1))
+	, ewtSequencer_            (ps)
+	, latency_                 (ps)
 {
 	// mode_ can still be overridden by environment!
 	theInterface_ = std::make_unique<DTCLib::DTC>(mode_,
@@ -158,6 +250,28 @@ mu2e::Mu2eSubEventReceiver::Mu2eSubEventReceiver(fhicl::ParameterSet const& ps)
 	mode_ = theInterface_->GetSimMode();
 	TLOG(TLVL_DEBUG) << "Mu2eSubEventReceiver Initialized with mode " << mode_;
 
+	rawOutputConfig_.buffer_bytes = ps.get<size_t>("raw_output_buffer_bytes", 16 << 20);
+	rawOutputConfig_.buffer_count = ps.get<size_t>("raw_output_buffer_count", 2);
+	rawOutputConfig_.direct_io = ps.get<bool>("raw_output_direct_io", false);
+	rawOutputConfig_.rotate_bytes = ps.get<size_t>("raw_output_rotate_bytes", 0);
+	rawOutputConfig_.rotate_seconds = ps.get<size_t>("raw_output_rotate_seconds", 0);
+	rawOutputConfig_.drop_policy = detail::RawOutputWriter::parseDropPolicy(ps.get<std::string>("raw_output_drop_policy", "newest"));
+
+	auto prefetch_depth = ps.get<size_t>("prefetch_ring_depth", 0);
+	if (prefetch_depth > 0)
+	{
+		prefetcher_ = std::make_unique<detail::FragmentPrefetcher>(prefetch_depth);
+	}
+
+	auto pool_size = ps.get<size_t>("fragment_pool_size", 0);
+	if (pool_size > 0)
+	{
+		fragmentPool_ = std::make_unique<detail::FragmentPool>(pool_size,
+															   ps.get<size_t>("max_fragment_size_bytes", 0x100000),
+															   ps.get<bool>("fragment_pool_huge_pages", false),
+															   placement_.numa_node);
+	}
+
 	// if in simulation mode, setup CFO
 	if (mode_ != 0)
 	{
@@ -178,8 +292,6 @@ mu2e::Mu2eSubEventReceiver::Mu2eSubEventReceiver(fhicl::ParameterSet const& ps)
 	if (ps.get<bool>("load_sim_file", false))
 	{
 		theInterface_->SetDetectorEmulatorInUse();
-		theInterface_->ResetDDR();
-		theInterface_->SoftReset();
 
 		char* file_c = getenv("DTCLIB_SIM_FILE");
 
@@ -190,9 +302,15 @@ mu2e::Mu2eSubEventReceiver::Mu2eSubEventReceiver(fhicl::ParameterSet const& ps)
 		}
 		if (sim_file.size() > 0)
 		{
-			simFileRead_ = false;
-			std::thread reader(&mu2e::Mu2eSubEventReceiver::readSimFile_, this, sim_file);
-			reader.detach();
+			// Resets DDR itself, unless the file is already there
+			simFileUpload_ = std::make_unique<detail::SimFileUpload>(ps, ps.get<int>("dtc_id", -1));
+			simFileUpload_->start(theInterface_.get(), sim_file);
+		}
+		else
+		{
+			detail::SimFileUpload::invalidateCache(ps, ps.get<int>("dtc_id", -1));
+			theInterface_->ResetDDR();
+			theInterface_->SoftReset();
 		}
 	}
 	else
@@ -202,18 +320,17 @@ mu2e::Mu2eSubEventReceiver::Mu2eSubEventReceiver(fhicl::ParameterSet const& ps)
 	}
 }
 
-void mu2e::Mu2eSubEventReceiver::readSimFile_(std::string sim_file)
-{
-	TLOG(TLVL_INFO) << "Starting read of simulation file " << sim_file << "."
-					<< " Please wait to start the run until finished.";
-	theInterface_->WriteSimFileToDTC(sim_file, true);
-	simFileRead_ = true;
-	TLOG(TLVL_INFO) << "Done reading simulation file into DTC memory.";
-}
-
 void mu2e::Mu2eSubEventReceiver::stop()
 {
-	rawOutputStream_.close();
+	if (prefetcher_) prefetcher_->stop();  // The prefetch thread may still be writing raw output
+	linkMetrics_.stop();
+	TLOG(TLVL_INFO) << "Readout latencies for this run:" << latency_.dump();
+	if (rawOutputWriter_)
+	{
+		rawOutputWriter_->close();
+		TLOG(TLVL_INFO) << "Raw output: " << rawOutputWriter_->bytes_written() << " bytes written, " << rawOutputWriter_->dropped() << " events dropped";
+		rawOutputWriter_.reset();
+	}
 
 	if (skip_dtc_init_) return;  // skip any control of DTC
 
@@ -223,6 +340,14 @@ void mu2e::Mu2eSubEventReceiver::stop()
 
 void mu2e::Mu2eSubEventReceiver::start()
 {
+	pacer_.reset();
+	requestPipeline_.reset();
+	ewtSequencer_.reset();
+	latency_.reset();
+	unemittedSince_ = {};
+	placementApplied_ = false;
+	TLOG(TLVL_INFO) << "Readout placement: " << placement_.describe();
+
 	if (rawOutput_)
 	{
 		std::string fileName = rawOutputFile_;
@@ -231,31 +356,50 @@ void mu2e::Mu2eSubEventReceiver::start()
 			std::string timestr = "_" + std::to_string(time(0));
 			fileName.insert(fileName.find(".bin"), timestr);
 		}
-		rawOutputStream_.open(fileName, std::ios::out | std::ios::app | std::ios::binary);
+		rawOutputConfig_.file_name = fileName;
+		rawOutputWriter_ = std::make_unique<detail::RawOutputWriter>(rawOutputConfig_);
+	}
+
+	linkMetrics_.start(linkMetricsInterval_);
+
+	if (prefetcher_)
+	{
+		prefetcher_->start([this](artdaq::FragmentPtrs& frags) { return readEventWindow_(frags); });
 	}
 }
 
 bool mu2e::Mu2eSubEventReceiver::getNextDTCFragment(artdaq::FragmentPtrs& frags, DTCLib::DTC_EventWindowTag ts_in)
 {
+	if (!placementApplied_)
+	{
+		if (!placement_.apply())
+		{
+			TLOG(TLVL_WARNING) << "Could not apply readout placement (" << placement_.describe() << ")";
+		}
+		placementApplied_ = true;
+	}
+
 	auto before_read = std::chrono::steady_clock::now();
-	int retryCount = 5;
 	std::vector<std::unique_ptr<DTCLib::DTC_SubEvent>> data;
-	while (data.size() == 0 && retryCount >= 0)
+	readoutWait_.begin();
+	do
 	{
 		try
 		{
 			TLOG(TLVL_TRACE + 25) << "Calling theInterface->GetData(" << ts_in.GetEventWindowTag(true) << ")";
 			data = theInterface_->GetSubEventData(ts_in);
-			TLOG(TLVL_TRACE + 25) << "Done calling theInterface->GetData(" << ts_in.GetEventWindowTag(true) << ") data.size()=" << data.size() << ", retryCount=" << retryCount;
+			TLOG(TLVL_TRACE + 25) << "Done calling theInterface->GetData(" << ts_in.GetEventWindowTag(true) << ") data.size()=" << data.size();
 		}
 		catch (std::exception const& ex)
 		{
 			TLOG(TLVL_ERROR) << "There was an error in the DTC Library: " << ex.what();
 		}
-		retryCount--;
-	}
-	if (retryCount < 0 && data.size() == 0)
+	} while (data.size() == 0 && !should_stop() && readoutWait_.next());
+	readoutWait_.finish(data.size() > 0);
+	if (data.size() == 0)
 	{
+		// Nothing more is coming for now; don't hold Fragments back waiting for EWTs that may never arrive
+		ewtSequencer_.flush(frags);
 		// Return true if no data in external CFO mode, otherwise false
 		return mode_ == 0;
 	}
@@ -268,66 +412,60 @@ bool mu2e::Mu2eSubEventReceiver::getNextDTCFragment(artdaq::FragmentPtrs& frags,
 	}
 
 	// GetSubEventData can return multiple EWTs, and we can assume that there is ONE DTC_SubEvent per EWT!
+	size_t data_bytes = 0;
 	for (auto& subevt : data)
 	{
+		DTCLib::DTC_EventWindowTag subevt_ts = subevt->GetEventWindowTag();
+		auto fragment_timestamp = subevt_ts.GetEventWindowTag(true);
+
+		if (first_timestamp_seen_ == 0)
+		{
+			first_timestamp_seen_ = fragment_timestamp;
+		}
+
+		fragment_timestamp = ewtSequencer_.unroll(fragment_timestamp);
+
 		size_t size_bytes = sizeof(DTCLib::DTC_EventHeader);
 		size_bytes += subevt->GetSubEventByteCount();
-		TLOG(TLVL_TRACE + 20) << "Size of event will be " << static_cast<int>(size_bytes) << "B";
+		TLOG(TLVL_TRACE + 20) << "Creating Fragment, sz=" << size_bytes << ", seqid=" << getCurrentSequenceID();
+
+		// Assemble the event directly in the Fragment payload: event header, then the sub-event as read from the DMA buffer
+		artdaq::FragmentPtr frag = fragmentPool_ ? fragmentPool_->take(size_bytes) : artdaq::Fragment::FragmentBytes(size_bytes);
+		frag->setSequenceID(getCurrentSequenceID());
+		frag->setFragmentID(fragment_ids_[0]);
+		frag->setUserType(FragmentType::DTCEVT);
+		frag->setTimestamp(fragment_timestamp);
+		auto ptr = frag->dataBeginBytes();
 
-		auto evt = std::make_unique<DTCLib::DTC_Event>(size_bytes);
-		
 		DTCLib::DTC_EventHeader evtHdr;
 		evtHdr.inclusive_event_byte_count = size_bytes;
 		evtHdr.num_dtcs = 1;
-                evtHdr.event_tag_low  = ts_out.GetEventWindowTag(true) & 0xFFFFFFFF;
-                evtHdr.event_tag_high = (ts_out.GetEventWindowTag(true) >> 32) & 0xFFFF;
-		memcpy(const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(evt->GetRawBufferPointer())), &evtHdr, sizeof(DTCLib::DTC_EventHeader));
-		auto ptr = reinterpret_cast<const uint8_t*>(evt->GetRawBufferPointer()) + sizeof(DTCLib::DTC_EventHeader);
-
-		TLOG(TLVL_TRACE + 20) << "Calling memcpy(" << (const void*)ptr << ", " << (void*)subevt->GetRawBufferPointer() << ", " << subevt->GetSubEventByteCount() << ")";
-		memcpy(const_cast<uint8_t*>(ptr), subevt->GetRawBufferPointer(), subevt->GetSubEventByteCount());
-		ptr += subevt->GetSubEventByteCount();
+		evtHdr.event_tag_low = subevt_ts.GetEventWindowTag(true) & 0xFFFFFFFF;
+		evtHdr.event_tag_high = (subevt_ts.GetEventWindowTag(true) >> 32) & 0xFFFF;
+		memcpy(ptr, &evtHdr, sizeof(DTCLib::DTC_EventHeader));
+		ptr += sizeof(DTCLib::DTC_EventHeader);
+
+		TLOG(TLVL_TRACE + 20) << "Calling memcpy(" << (void*)ptr << ", " << (void*)subevt->GetRawBufferPointer() << ", " << subevt->GetSubEventByteCount() << ")";
+		memcpy(ptr, subevt->GetRawBufferPointer(), subevt->GetSubEventByteCount());
+
+		// In-place view of the Fragment payload for header inspection, printing and raw output
 		TLOG(TLVL_TRACE + 20) << "Calling SetupEvent";
-		evt->SetupEvent();
-		TLOG(TLVL_TRACE + 20) << "Setting EventWindowTag to " << ts_out.GetEventWindowTag(true);
-		evt->SetEventWindowTag(ts_out);
-
-		for (size_t se = 0; se < evt->GetSubEventCount(); ++se)
-		  {
-		    auto subevt = evt->GetSubEvent(se);
-		    auto subevtheader =  subevt->GetHeader();
-		    metricMan->sendMetric("ROC link0 status", subevtheader->link0_status, "status", 3, artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link1 status", subevtheader->link1_status, "status", 3, artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link2 status", subevtheader->link2_status, "status", 3, artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link3 status", subevtheader->link3_status, "status", 3, artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link4 status", subevtheader->link4_status, "status", 3, artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link5 status", subevtheader->link5_status, "status", 3, artdaq::MetricMode::Maximum);
-
-		    metricMan->sendMetric("ROC link0 latency", subevtheader->link0_drp_rx_latency, "status", 3, artdaq::MetricMode::Minimum|artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link1 latency", subevtheader->link1_drp_rx_latency, "status", 3, artdaq::MetricMode::Minimum|artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link2 latency", subevtheader->link2_drp_rx_latency, "status", 3, artdaq::MetricMode::Minimum|artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link3 latency", subevtheader->link3_drp_rx_latency, "status", 3, artdaq::MetricMode::Minimum|artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link4 latency", subevtheader->link4_drp_rx_latency, "status", 3, artdaq::MetricMode::Minimum|artdaq::MetricMode::Maximum);
-		    metricMan->sendMetric("ROC link5 latency", subevtheader->link5_drp_rx_latency, "status", 3, artdaq::MetricMode::Minimum|artdaq::MetricMode::Maximum);
-
-
-		    for (size_t bl = 0; bl < subevt->GetDataBlockCount(); ++bl)
-		      {
-			auto block = subevt->GetDataBlock(bl);
-			auto first = block->GetHeader();
-			std::string  nn  = "Packets per ROC " + std::to_string(bl);
-			metricMan->sendMetric(nn,  first->GetPacketCount(), "Packages", 3, artdaq::MetricMode::Average);
-			std::string  rocLink = "ROC "+std::to_string(first->GetLinkID())+" status";
-			metricMan->sendMetric(rocLink, first->GetStatus(), "status", 3, artdaq::MetricMode::Maximum);			
-		      }
-		  }
-		
+		DTCLib::DTC_Event evt(frag->dataBeginBytes());
+		evt.SetupEvent();
+		TLOG(TLVL_TRACE + 20) << "Setting EventWindowTag to " << subevt_ts.GetEventWindowTag(true);
+		evt.SetEventWindowTag(subevt_ts);
+
+		for (size_t se = 0; se < evt.GetSubEventCount(); ++se)
+		{
+			linkMetrics_.add(*evt.GetSubEvent(se));
+		}
+
 		if (print_packets_)
 		{
-		        TLOG(TLVL_INFO) << "[print_packets starts] subEventCounts: "<<  evt->GetSubEventCount();
-			for (size_t se = 0; se < evt->GetSubEventCount(); ++se)
+		        TLOG(TLVL_INFO) << "[print_packets starts] subEventCounts: "<<  evt.GetSubEventCount();
+			for (size_t se = 0; se < evt.GetSubEventCount(); ++se)
 			{
-				auto subevt = evt->GetSubEvent(se);
+				auto subevt = evt.GetSubEvent(se);
 				auto subevtheader =  subevt->GetHeader();
 				TLOG(TLVL_INFO) << subevtheader->toJson();
 				for (size_t bl = 0; bl < subevt->GetDataBlockCount(); ++bl)
@@ -344,51 +482,45 @@ bool mu2e::Mu2eSubEventReceiver::getNextDTCFragment(artdaq::FragmentPtrs& frags,
 		}
 		if (rawOutput_)
 		{
-			evt->WriteEvent(rawOutputStream_, false);
-		}
-
-		// auto after_print = std::chrono::steady_clock::now();
-
-		auto fragment_timestamp = ts_out.GetEventWindowTag(true);
-
-		if (first_timestamp_seen_ == 0)
-		{
-			first_timestamp_seen_ = fragment_timestamp;
-		}
-
-		if (fragment_timestamp < highest_timestamp_seen_)
-		{
-			fragment_timestamp += timestamp_loops_ * highest_timestamp_seen_;
-		}
-		else if (fragment_timestamp > highest_timestamp_seen_)
-		{
-			highest_timestamp_seen_ = fragment_timestamp;
-		}
-		else
-		{
-			fragment_timestamp += timestamp_loops_ * highest_timestamp_seen_;
-			timestamp_loops_++;
+			rawOutputWriter_->write(frag->dataBeginBytes(), size_bytes);
 		}
 
-		TLOG(TLVL_TRACE + 20) << "Creating Fragment, sz=" << evt->GetEventByteCount() << ", seqid=" << getCurrentSequenceID();
-		frags.emplace_back(new artdaq::Fragment(getCurrentSequenceID(), fragment_ids_[0], FragmentType::DTCEVT, fragment_timestamp));
-		frags.back()->resizeBytes(evt->GetEventByteCount());
-		memcpy(frags.back()->dataBegin(), evt->GetRawBufferPointer(), evt->GetEventByteCount());
-		metricMan->sendMetric("Average Event Size",  evt->GetEventByteCount(), "Bytes", 3, artdaq::MetricMode::Average);
+		metricMan->sendMetric("Average Event Size",  evt.GetEventByteCount(), "Bytes", 3, artdaq::MetricMode::Average);
+		data_bytes += subevt->GetSubEventByteCount();
+		ewtSequencer_.push(std::move(frag), frags);
+		if (ewtSequencer_.dropped()) continue;  // A duplicate window is read again under the same sequence ID
 		TLOG(TLVL_TRACE + 20) << "Incrementing event counter";
 		ev_counter_inc();
 	}
 	auto after_copy = std::chrono::steady_clock::now();
+	if (unemittedSince_ == std::chrono::steady_clock::time_point()) unemittedSince_ = after_copy;
 	TLOG(TLVL_TRACE + 20) << "Reporting Metrics";
 	auto hwTime = theInterface_->GetDevice()->GetDeviceTime();
 
+	// Every sub-event in this read crossed PCIe in hwTime, not just the last one
 	double hw_timestamp_rate = 1 / hwTime;
-	double hw_data_rate = frags.back()->sizeBytes() / hwTime;
+	double hw_data_rate = data_bytes / hwTime;
 
-	metricMan->sendMetric("DTC Read Time", artdaq::TimeUtils::GetElapsedTime(after_read, after_copy), "s", 3, artdaq::MetricMode::Average);
-	metricMan->sendMetric("Fragment Prep Time", artdaq::TimeUtils::GetElapsedTime(before_read, after_read), "s", 3, artdaq::MetricMode::Average);
+	latency_.record(detail::StageLatencies::Read, before_read, after_read);
+	latency_.record(detail::StageLatencies::Copy, after_read, after_copy);
+	latency_.publish();
+	metricMan->sendMetric("DTC Read Time", artdaq::TimeUtils::GetElapsedTime(before_read, after_read), "s", 3, artdaq::MetricMode::Average);
+	metricMan->sendMetric("Fragment Prep Time", artdaq::TimeUtils::GetElapsedTime(after_read, after_copy), "s", 3, artdaq::MetricMode::Average);
 	metricMan->sendMetric("HW Timestamp Rate", hw_timestamp_rate, "timestamps/s", 1, artdaq::MetricMode::Average);
 	metricMan->sendMetric("PCIe Transfer Rate", hw_data_rate, "B/s", 1, artdaq::MetricMode::Average);
+	if (rawOutputWriter_)
+	{
+		metricMan->sendMetric("Raw Output Queue Depth", rawOutputWriter_->queue_depth(), "buffers", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+		metricMan->sendMetric("Raw Output Dropped Events", rawOutputWriter_->dropped(), "events", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Raw Output Write Errors", rawOutputWriter_->write_errors(), "errors", 3, artdaq::MetricMode::LastPoint);
+	}
+	if (fragmentPool_)
+	{
+		metricMan->sendMetric("Fragment Pool Available", fragmentPool_->available(), "Fragments", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Minimum);
+		metricMan->sendMetric("Fragment Pool Misses", fragmentPool_->misses(), "Fragments", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric("Fragment Pool Refill Size", fragmentPool_->refillBytes(), "B", 3, artdaq::MetricMode::LastPoint);
+	}
+	ewtSequencer_.sendMetrics();
 
 	TLOG(TLVL_TRACE + 20) << "Returning true";
 
@@ -24,8 +24,14 @@
 #include "fhiclcpp/fwd.h"
 #include "artdaq-core-mu2e/Overlays/STMFragment.hh"
 #include "artdaq-core-mu2e/Overlays/FragmentType.hh"
+#include "artdaq-mu2e/Generators/detail/ContainerFragmentBuilder.hh"
+#include "artdaq-mu2e/Generators/detail/MappedSTMFile.hh"
+#include "artdaq-mu2e/Generators/detail/RawOutputWriter.hh"
+#include "artdaq-mu2e/Generators/detail/STMCompression.hh"
+#include "artdaq-mu2e/Generators/detail/ThreadPlacement.hh"
 
 #include <atomic>
+#include <memory>
 #include <vector>
 
 #include "dtcInterfaceLib/DTC.h"
@@ -47,17 +53,38 @@ private:
 
 	bool getNext_(artdaq::FragmentPtrs& output) override;
 
-	void start() override {}
+	void start() override;
 
 	void stopNoMutex() override {}
 
-	void stop() override {}
+	void stop() override;
+
+	// STM Fragment holding one slice (tHdr, sHdr, samples) copied from the mapped input
+	artdaq::FragmentPtr makeSliceFragment_(detail::MappedSTMFile::Slice const& slice);
+
+	// ContainerFragment of STM Fragments, one per slice, built in a single allocation
+	artdaq::FragmentPtr makeContainerFragment_(std::vector<detail::MappedSTMFile::Slice> const& slices);
+
+	// False (and the slice is stored raw) if its sample bytes are not a whole number of samples
+	bool compressible_(detail::MappedSTMFile::Slice const& slice);
+
+	// Write the slice headers followed by the encoded samples to out, which must hold the headers plus
+	// STMCompressor::maxEncodedBytes of the samples. Returns the bytes written.
+	size_t encodeSlice_(detail::MappedSTMFile::Slice const& slice, uint8_t* out, detail::STMCompressedMetadata& md);
 		
 	// STM-specific stuff
 	bool fromInputFile_{false};
-	std::ifstream inputFileStream_;
+	std::unique_ptr<detail::MappedSTMFile> inputFile_;
+	size_t slicesPerFragment_{1};    // >1 packs slices into a ContainerFragment; 0 means no count limit
+	size_t fragmentTargetBytes_{0};  // Close the container before the slice that would take it past this many bytes (0: no target)
+	detail::STMCompressor compressor_;  // stm_compression: zero suppression and bit-packing of the samples
+	std::vector<std::vector<uint8_t>> encodedSlices_;  // Scratch for compressed slices bound for a container
+	std::vector<detail::STMCompressedMetadata> encodedMetadata_;
 	bool toOutputFile_{false};
-	std::ofstream outputFileStream_;
+	detail::RawOutputWriter::Config outputConfig_;
+	std::unique_ptr<detail::RawOutputWriter> outputWriter_;  // Created at start() when to_output_file is set
+	detail::ThreadPlacement placement_;  // readout_cpus/readout_numa_node for the getNext_ thread
+	bool placementApplied_{false};
 
 	// FHiCL-configurable variables. Note that the C++ variable names
 	// are the FHiCL variable names with a "_" appended
@@ -1,6 +1,8 @@
 #include "artdaq-mu2e/Generators/STMReceiver.hh"
 
+#include "artdaq/DAQdata/Globals.hh"
 #include "artdaq/Generators/GeneratorMacros.hh"
+#include "cetlib_except/exception.h"
 
 #include "trace.h"
 #define TRACE_NAME "STMReceiver"
@@ -8,33 +10,81 @@
 mu2e::STMReceiver::STMReceiver(fhicl::ParameterSet const &ps)
 	: artdaq::CommandableFragmentGenerator(ps)
 	, fromInputFile_(ps.get<bool>("from_input_file", false))
+	, slicesPerFragment_(ps.get<size_t>("slices_per_fragment", 1))
+	, fragmentTargetBytes_(ps.get<size_t>("fragment_target_bytes", 0))
+	, compressor_(ps.get<fhicl::ParameterSet>("stm_compression", fhicl::ParameterSet()))
 	, toOutputFile_(ps.get<bool>("to_output_file", false))
+	, placement_(ps)
 {
 	TLOG(TLVL_DEBUG) << "STMReceiver Initialized";
 
+	if (slicesPerFragment_ == 0 && fragmentTargetBytes_ == 0)
+	{
+		slicesPerFragment_ = 1;  // Without either limit the whole file would go into one Fragment
+	}
+
 	if (fromInputFile_)
 	{
 		auto input_file = ps.get<std::string>("input_file", "");
-		inputFileStream_.open(input_file, std::ios::in | std::ios::binary);
+		inputFile_ = std::make_unique<detail::MappedSTMFile>(input_file,
+															 ps.get<size_t>("input_readahead_bytes", 64 << 20),
+															 ps.get<bool>("slice_size_in_samples", false));
+		if (!inputFile_->good())
+		{
+			TLOG(TLVL_ERROR) << "Cannot map STM input file " << input_file;
+		}
 	}
 
-	if (toOutputFile_)
+	if (compressor_.enabled())
 	{
-		auto output_file = ps.get<std::string>("output_file", "");
-		outputFileStream_.open(output_file, std::ios::out | std::ios::binary);
+		// Compressed slices keep FragmentType::STM (there is no separate type for them in artdaq-core-mu2e), so
+		// a consumer that does not check for STMCompressedMetadata would read the encoded block as samples
+		if (!ps.get<fhicl::ParameterSet>("stm_compression").get<bool>("consumers_decode_compressed", false))
+		{
+			throw cet::exception("STMReceiver") << "stm_compression.enable requires stm_compression.consumers_decode_compressed: compressed slices "
+												<< "are still tagged FragmentType::STM, and only consumers that check for STMCompressedMetadata can read them";
+		}
+		TLOG(TLVL_INFO) << "STM slices will be compressed; Fragments carry STMCompressedMetadata";
 	}
+
+	outputConfig_.file_name = ps.get<std::string>("output_file", "");
+	outputConfig_.buffer_bytes = ps.get<size_t>("output_buffer_bytes", 16 << 20);
+	outputConfig_.buffer_count = ps.get<size_t>("output_buffer_count", 4);
+	outputConfig_.direct_io = ps.get<bool>("output_direct_io", false);
+	outputConfig_.rotate_bytes = ps.get<size_t>("output_rotate_bytes", 0);
+	outputConfig_.rotate_seconds = ps.get<size_t>("output_rotate_seconds", 0);
+	outputConfig_.drop_policy = detail::RawOutputWriter::parseDropPolicy(ps.get<std::string>("output_drop_policy", "newest"));
 }
 
-mu2e::STMReceiver::~STMReceiver()
+mu2e::STMReceiver::~STMReceiver() {}
+
+void mu2e::STMReceiver::start()
 {
-	if (fromInputFile_)
+	placementApplied_ = false;
+	TLOG(TLVL_INFO) << "Readout placement: " << placement_.describe();
+
+	if (toOutputFile_)
 	{
-		inputFileStream_.close();
+		// The writer appends, so every run gets its own files
+		auto config = outputConfig_;
+		std::string runstr = "_run" + std::to_string(run_number()) + "_" + std::to_string(time(0));
+		auto pos = config.file_name.find(".bin");
+		if (pos != std::string::npos)
+			config.file_name.insert(pos, runstr);
+		else
+			config.file_name += runstr;
+		TLOG(TLVL_INFO) << "STM output: writing to " << config.file_name;
+		outputWriter_ = std::make_unique<detail::RawOutputWriter>(config);
 	}
+}
 
-	if (toOutputFile_)
+void mu2e::STMReceiver::stop()
+{
+	if (outputWriter_)
 	{
-		outputFileStream_.close();
+		outputWriter_->close();
+		TLOG(TLVL_INFO) << "STM output: " << outputWriter_->bytes_written() << " bytes written, " << outputWriter_->dropped() << " slices dropped";
+		outputWriter_.reset();
 	}
 }
 
@@ -45,55 +95,155 @@ bool mu2e::STMReceiver::getNext_(artdaq::FragmentPtrs &frags)
 		return false;
 	}
 
+	if (!placementApplied_)
+	{
+		if (!placement_.apply())
+		{
+			TLOG(TLVL_WARNING) << "Could not apply readout placement (" << placement_.describe() << ")";
+		}
+		placementApplied_ = true;
+	}
+
 	if (fromInputFile_)
 	{
-		if (inputFileStream_.eof())
-		{  // if we reached the end of the file, then stop
+		// Slices are viewed in the mapping until the Fragment is built, so each one is copied once
+		std::vector<detail::MappedSTMFile::Slice> slices;
+		size_t slice_bytes = 0;
+		detail::MappedSTMFile::Slice slice;
+		while ((slicesPerFragment_ == 0 || slices.size() < slicesPerFragment_) && inputFile_->next(slice))
+		{
+			// Stop before the slice that would take the container past the target; a slice larger than the target goes on its own
+			if (fragmentTargetBytes_ > 0 && !slices.empty() && slice_bytes + slice.bytes > fragmentTargetBytes_)
+			{
+				inputFile_->unread(slice);
+				break;
+			}
+			slices.push_back(slice);
+			slice_bytes += slice.bytes;
+			if (outputWriter_)
+			{
+				outputWriter_->write(slice.begin, slice.bytes);
+			}
+		}
+
+		if (slices.empty())
+		{
+			// End of the file (or a slice running past it), so stop
+			if (inputFile_->truncated())
+			{
+				TLOG(TLVL_WARNING) << "STM input file ends inside a slice at offset " << inputFile_->offset() << " of " << inputFile_->size();
+			}
 			return false;
 		}
+
+		if (slicesPerFragment_ == 1)
+		{
+			frags.emplace_back(makeSliceFragment_(slices[0]));
+		}
+		else
+		{
+			// The ContainerFragment index gives unpackers each slice's offset without walking the headers
+			frags.emplace_back(makeContainerFragment_(slices));
+			metricMan->sendMetric("STM Slices per Fragment", slices.size(), "slices", 3, artdaq::MetricMode::Average);
+		}
+		metricMan->sendMetric("STM Slice Bytes", slice_bytes, "B", 1, artdaq::MetricMode::Rate);
+		if (outputWriter_)
+		{
+			metricMan->sendMetric("STM Output Queue Depth", outputWriter_->queue_depth(), "buffers", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+			metricMan->sendMetric("STM Output Dropped Slices", outputWriter_->dropped(), "slices", 3, artdaq::MetricMode::LastPoint);
+			metricMan->sendMetric("STM Output Write Errors", outputWriter_->write_errors(), "errors", 3, artdaq::MetricMode::LastPoint);
+		}
 	}
 
-	// STMFragment::STMDataPacket data[1]; //Andy's implementation
-	STMFragment::STM_tHdr tHdr;
-	STMFragment::STM_sHdr sHdr;
-	uint16_t data[0x50000];  // read this from fhicl::ps. This acts as a buffer for the adc data.
-	uint16_t data_size = 0;
-	if (fromInputFile_)
+	ev_counter_inc();  // increment event counter
+	return true;
+}
+
+artdaq::FragmentPtr mu2e::STMReceiver::makeSliceFragment_(detail::MappedSTMFile::Slice const &slice)
+{
+	double fragment_timestamp = 0;
+	if (!compressor_.enabled() || !compressible_(slice))
 	{
-		inputFileStream_.read(reinterpret_cast<char *>(&tHdr), sw_tHdr_size_bytes);
-		inputFileStream_.read(reinterpret_cast<char *>(&sHdr), sw_sHdr_size_bytes);
-		data_size = sHdr.sliceSize();
-		inputFileStream_.read(reinterpret_cast<char *>(&data[0]), data_size);
-
-		double fragment_timestamp = 0;
-		frags.emplace_back(new artdaq::Fragment(ev_counter(), fragment_id(), FragmentType::STM, fragment_timestamp));
-		// Next two lines define an inefficient buffer implementation.
-		// frags.back()->resizeBytes(0x50000);
-		// memcpy(frags.back()->dataBegin(), &data[0], 0x50000);
-
-		frags.back()->resizeBytes(sw_tHdr_size_bytes + sw_sHdr_size_bytes + data_size);
-		uint8_t *dataBegin = reinterpret_cast<uint8_t *>(frags.back()->dataBegin());
-		memcpy(dataBegin, &tHdr, sw_tHdr_size_bytes);
-		dataBegin += sw_tHdr_size_bytes;
-		memcpy(dataBegin, &sHdr, sw_sHdr_size_bytes);
-		dataBegin += sw_sHdr_size_bytes;
-		memcpy(dataBegin, &data[0], data_size);
+		// tHdr, sHdr and samples are contiguous in the file, so one copy fills the Fragment
+		auto frag = artdaq::Fragment::FragmentBytes(slice.bytes);
+		frag->setSequenceID(ev_counter());
+		frag->setFragmentID(fragment_id());
+		frag->setUserType(FragmentType::STM);
+		frag->setTimestamp(fragment_timestamp);
+		memcpy(frag->dataBeginBytes(), slice.begin, slice.bytes);
+		return frag;
 	}
 
-	// Andy's implementation
-	// if (toOutputFile_) {
-	// outputFileStream_.write(reinterpret_cast<char *>(&data), sizeof(data[0]));
-	//}
+	constexpr size_t header_bytes = sw_tHdr_size_bytes + sw_sHdr_size_bytes;
+	size_t n_samples = (slice.bytes - header_bytes) / sizeof(int16_t);
+	// Allocate for the worst case and encode in place, then shrink to what the encoder wrote
+	auto frag = artdaq::Fragment::FragmentBytes(header_bytes + detail::STMCompressor::maxEncodedBytes(n_samples), ev_counter(), fragment_id(),
+												FragmentType::STM, detail::STMCompressedMetadata(), fragment_timestamp);
+	detail::STMCompressedMetadata md;
+	auto bytes = encodeSlice_(slice, frag->dataBeginBytes(), md);
+	frag->updateMetadata(md);
+	frag->resizeBytes(bytes);
+	return frag;
+}
 
-	if (toOutputFile_)
+artdaq::FragmentPtr mu2e::STMReceiver::makeContainerFragment_(std::vector<detail::MappedSTMFile::Slice> const& slices)
+{
+	double fragment_timestamp = 0;
+	std::vector<detail::ContainerFragmentBuilder::Block> blocks;
+	blocks.reserve(slices.size());
+	if (!compressor_.enabled())
 	{
-		outputFileStream_.write(reinterpret_cast<char *>(&tHdr), sw_tHdr_size_bytes);
-		outputFileStream_.write(reinterpret_cast<char *>(&sHdr), sw_sHdr_size_bytes);
-		outputFileStream_.write(reinterpret_cast<char *>(&data), data_size);
+		for (auto& slice : slices)
+		{
+			blocks.push_back({slice.begin, slice.bytes});
+		}
 	}
+	else
+	{
+		// Slices are encoded into buffers kept across calls, and their metadata goes into each block's header
+		constexpr size_t header_bytes = sw_tHdr_size_bytes + sw_sHdr_size_bytes;
+		if (encodedSlices_.size() < slices.size()) encodedSlices_.resize(slices.size());
+		encodedMetadata_.resize(slices.size());
+		for (size_t ii = 0; ii < slices.size(); ++ii)
+		{
+			if (!compressible_(slices[ii]))
+			{
+				blocks.push_back({slices[ii].begin, slices[ii].bytes});
+				continue;
+			}
+			auto& buffer = encodedSlices_[ii];
+			size_t n_samples = (slices[ii].bytes - header_bytes) / sizeof(int16_t);
+			buffer.resize(std::max(buffer.size(), header_bytes + detail::STMCompressor::maxEncodedBytes(n_samples)));
+			auto bytes = encodeSlice_(slices[ii], buffer.data(), encodedMetadata_[ii]);
+			blocks.push_back({buffer.data(), bytes, &encodedMetadata_[ii], sizeof(detail::STMCompressedMetadata)});
+		}
+	}
+	return detail::ContainerFragmentBuilder::build(blocks, ev_counter(), fragment_id(), FragmentType::STM, fragment_timestamp);
+}
 
-	ev_counter_inc();  // increment event counter
-	return true;
+bool mu2e::STMReceiver::compressible_(detail::MappedSTMFile::Slice const& slice)
+{
+	// An odd number of sample bytes (slice sizes in bytes, slice_size_in_samples false) cannot be split into
+	// int16_t samples without losing the last byte, so such a slice is passed on raw, without the metadata
+	constexpr size_t header_bytes = sw_tHdr_size_bytes + sw_sHdr_size_bytes;
+	if ((slice.bytes - header_bytes) % sizeof(int16_t) == 0) return true;
+	metricMan->sendMetric("STM Uncompressed Odd Slices", 1, "slices", 3, artdaq::MetricMode::Accumulate);
+	return false;
+}
+
+size_t mu2e::STMReceiver::encodeSlice_(detail::MappedSTMFile::Slice const& slice, uint8_t* out, detail::STMCompressedMetadata& md)
+{
+	// Headers are kept as-is; the samples are replaced by the encoded block described by the metadata
+	constexpr size_t header_bytes = sw_tHdr_size_bytes + sw_sHdr_size_bytes;
+	size_t n_samples = (slice.bytes - header_bytes) / sizeof(int16_t);
+	memcpy(out, slice.begin, header_bytes);
+	auto encoded_bytes = compressor_.encode(slice.begin + header_bytes, n_samples, out + header_bytes, md);
+
+	if (n_samples > 0)
+	{
+		metricMan->sendMetric("STM Compression Ratio", static_cast<double>(n_samples * sizeof(int16_t)) / encoded_bytes, "", 3, artdaq::MetricMode::Average);
+	}
+	return header_bytes + encoded_bytes;
 }
 
 // The following macro is defined in artdaq's GeneratorMacros.hh header
@@ -0,0 +1,114 @@
+#ifndef artdaq_mu2e_Generators_detail_ContainerFragmentBuilder_hh
+#define artdaq_mu2e_Generators_detail_ContainerFragmentBuilder_hh
+
+#include "artdaq-core/Data/ContainerFragment.hh"
+#include "artdaq-core/Data/ContainerFragmentLoader.hh"
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-core/Data/detail/RawFragmentHeader.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Builds a ContainerFragment of same-typed blocks with a single payload allocation: the container is sized
+// from the summed block sizes, then each block's Fragment header, metadata and data are written in place and the
+// index is written once at the end. ContainerFragmentLoader::addFragment instead needs a temporary
+// Fragment per block and regrows the container (and rewrites the index) for each one.
+class ContainerFragmentBuilder
+{
+public:
+	struct Block
+	{
+		const void* data;
+		size_t bytes;
+		const void* metadata{nullptr};  // Written between the block's header and its data, if given
+		size_t metadata_bytes{0};
+	};
+
+	static artdaq::FragmentPtr build(std::vector<Block> const& blocks, artdaq::Fragment::sequence_id_t seq, artdaq::Fragment::fragment_id_t fragment_id,
+									 artdaq::Fragment::type_t type, artdaq::Fragment::timestamp_t ts)
+	{
+		// Every block gets the same header apart from its word count, so copy it from an empty Fragment
+		artdaq::Fragment header(seq, fragment_id, type, ts);
+		const size_t header_bytes = header.sizeBytes();
+
+		size_t payload_bytes = 0;
+		for (auto& block : blocks) payload_bytes += header_bytes + paddedBytes_(block.metadata_bytes) + paddedBytes_(block.bytes);
+		const size_t index_bytes = sizeof(uint64_t) * (blocks.size() + 1);
+
+		auto frag = std::make_unique<artdaq::Fragment>(seq, fragment_id);
+		frag->setTimestamp(ts);
+		{
+			artdaq::ContainerFragmentLoader cfl(*frag, type);
+			cfl.set_missing_data(false);
+		}
+		frag->resizeBytes(payload_bytes + index_bytes);
+
+		auto out = reinterpret_cast<uint8_t*>(frag->dataBegin());
+		std::vector<uint64_t> index(blocks.size() + 1);
+		size_t offset = 0;
+		for (size_t ii = 0; ii < blocks.size(); ++ii)
+		{
+			auto metadata_bytes = paddedBytes_(blocks[ii].metadata_bytes);
+			auto block_bytes = paddedBytes_(blocks[ii].bytes);
+			memcpy(out + offset, header.headerAddress(), header_bytes);
+			auto block_header = reinterpret_cast<artdaq::detail::RawFragmentHeader*>(out + offset);
+			block_header->word_count = (header_bytes + metadata_bytes + block_bytes) / sizeof(artdaq::Fragment::RawDataType);
+			block_header->metadata_word_count = metadata_bytes / sizeof(artdaq::Fragment::RawDataType);
+			offset += header_bytes;
+			if (metadata_bytes > 0)
+			{
+				memcpy(out + offset, blocks[ii].metadata, blocks[ii].metadata_bytes);
+				memset(out + offset + blocks[ii].metadata_bytes, 0, metadata_bytes - blocks[ii].metadata_bytes);
+				offset += metadata_bytes;
+			}
+			memcpy(out + offset, blocks[ii].data, blocks[ii].bytes);
+			memset(out + offset + blocks[ii].bytes, 0, block_bytes - blocks[ii].bytes);
+			offset += block_bytes;
+			index[ii] = offset;  // Entry ii is the end of block ii, as ContainerFragmentLoader writes it
+		}
+		index[blocks.size()] = artdaq::ContainerFragment::CONTAINER_MAGIC;
+		memcpy(out + offset, index.data(), index_bytes);
+
+		auto md = frag->metadata<artdaq::ContainerFragment::Metadata>();
+		md->block_count = blocks.size();
+		md->index_offset = offset;
+		md->has_index = 1;
+		return frag;
+	}
+
+	// Read the container back through artdaq::ContainerFragment and check that block ii is the size of
+	// blocks[ii] and starts with its first check_bytes bytes. Returns the first bad block, or blocks.size().
+	static size_t verify(artdaq::Fragment const& frag, std::vector<Block> const& blocks, size_t check_bytes = 64)
+	{
+		artdaq::ContainerFragment cf(frag);
+		if (cf.block_count() != blocks.size()) return 0;
+
+		const size_t header_bytes = artdaq::detail::RawFragmentHeader::num_words() * sizeof(artdaq::Fragment::RawDataType);
+		auto base = static_cast<const uint8_t*>(cf.dataBegin());
+		for (size_t ii = 0; ii < blocks.size(); ++ii)
+		{
+			auto metadata_bytes = paddedBytes_(blocks[ii].metadata_bytes);
+			if (cf.fragSize(ii) != header_bytes + metadata_bytes + paddedBytes_(blocks[ii].bytes)) return ii;
+			auto payload = base + cf.fragmentIndex(ii) + header_bytes + metadata_bytes;
+			if (memcmp(payload, blocks[ii].data, std::min(check_bytes, blocks[ii].bytes)) != 0) return ii;
+		}
+		return blocks.size();
+	}
+
+private:
+	static size_t paddedBytes_(size_t bytes)
+	{
+		constexpr size_t word = sizeof(artdaq::Fragment::RawDataType);
+		return (bytes + word - 1) / word * word;
+	}
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
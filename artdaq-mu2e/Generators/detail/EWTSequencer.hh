@@ -0,0 +1,200 @@
+#ifndef artdaq_mu2e_Generators_detail_EWTSequencer_hh
+#define artdaq_mu2e_Generators_detail_EWTSequencer_hh
+
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq/DAQdata/Globals.hh"
+#include "fhiclcpp/ParameterSet.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+namespace mu2e {
+namespace detail {
+
+// Turns the Event Window Tags read from a DTC into monotonic Fragment timestamps and hands
+// Fragments on in EWT order.
+//
+// unroll() extends raw EWTs across playback loops. The sim file is taken to have started over
+// only on a backward jump of at least ewt_wrap_distance, so a late or repeated EWT (even the
+// first one of the loop) does not shift the timestamps after it. push() holds up to
+// ewt_reorder_window Fragments and releases them in timestamp order, counting gaps (missing EWTs
+// between released Fragments), duplicates and Fragments that arrived after their slot was
+// released. A late Fragment takes back the gap it was counted in. Duplicates are dropped; late
+// Fragments are still passed on. Sequence IDs are handed
+// out again in release order (the IDs themselves stay the ones assigned at read time), so they
+// rise with the EWT and stay contiguous when a duplicate is dropped; push() with renumber = false
+// leaves them alone, e.g. for request-driven readout.
+//   ewt_reorder_window: Fragments held for reordering (0: pass straight through)
+//   ewt_step:           EWT increment between consecutive windows on this DTC (default n_dtcs_in_chain)
+//   ewt_wrap_distance:  backward jump treated as a playback loop (default 4096 * ewt_step)
+class EWTSequencer
+{
+public:
+	explicit EWTSequencer(fhicl::ParameterSet const& ps)
+		: window_(ps.get<size_t>("ewt_reorder_window", 0))
+		, step_(std::max(ps.get<uint64_t>("ewt_step", ps.get<uint64_t>("n_dtcs_in_chain", 1)), uint64_t(1)))
+		, wrap_distance_(std::max(ps.get<uint64_t>("ewt_wrap_distance", 4096 * step_), uint64_t(1)))
+	{}
+
+	void reset()
+	{
+		buffer_.clear();
+		sequence_ids_.clear();
+		recent_.clear();
+		missing_.clear();
+		have_raw_ = have_emitted_ = dropped_ = false;
+		highest_raw_ = offset_ = last_emitted_ = 0;
+		gaps_ = duplicates_ = late_ = wraps_ = 0;
+	}
+
+	// Map a raw EWT onto the extended timeline
+	uint64_t unroll(uint64_t raw)
+	{
+		if (!have_raw_)
+		{
+			have_raw_ = true;
+			highest_raw_ = raw;
+		}
+		else if (raw < highest_raw_ && highest_raw_ - raw >= wrap_distance_)
+		{
+			// The file started over: continue one step past the highest extended EWT of the previous loop
+			offset_ += highest_raw_ + step_ - raw;
+			highest_raw_ = raw;
+			++wraps_;
+		}
+		else if (raw > highest_raw_)
+		{
+			highest_raw_ = raw;
+		}
+		return raw + offset_;
+	}
+
+	// Highest raw EWT seen in the current playback loop
+	uint64_t highestSeen() const { return highest_raw_; }
+
+	// Add a Fragment whose timestamp is already unrolled. Fragments that are ready are appended to output in
+	// timestamp order; returns how many were appended.
+	size_t push(artdaq::FragmentPtr frag, artdaq::FragmentPtrs& output, bool renumber = true)
+	{
+		renumber_ = renumber;
+		dropped_ = false;
+		sequence_ids_.push_back(frag->sequenceID());
+		auto ts = frag->timestamp();
+		bool released = have_emitted_ && ts <= last_emitted_;
+		if ((released && std::find(recent_.begin(), recent_.end(), ts) != recent_.end()) || buffer_.count(ts))
+		{
+			// The caller should not count the window (see dropped()), so its sequence ID goes to the next one read
+			++duplicates_;
+			sequence_ids_.pop_back();
+			dropped_ = true;
+			return 0;
+		}
+		if (released)
+		{
+			++late_;
+			// It was counted as a gap when the Fragment after it went out
+			if (missing_.erase(ts)) --gaps_;
+			remember_(ts);
+			release_(std::move(frag), output);
+			return 1;
+		}
+		buffer_.emplace(ts, std::move(frag));
+
+		size_t emitted = 0;
+		while (!buffer_.empty() && (buffer_.size() > window_ || (have_emitted_ && buffer_.begin()->first == last_emitted_ + step_)))
+		{
+			emit_(output);
+			++emitted;
+		}
+		return emitted;
+	}
+
+	// Release everything held, e.g. when the DTC has gone quiet or the run is stopping
+	size_t flush(artdaq::FragmentPtrs& output)
+	{
+		size_t emitted = buffer_.size();
+		while (!buffer_.empty()) emit_(output);
+		return emitted;
+	}
+
+	void sendMetrics(std::string const& prefix = "") const
+	{
+		metricMan->sendMetric(prefix + "EWT Gaps", gaps_, "windows", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric(prefix + "EWT Duplicates", duplicates_, "windows", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric(prefix + "EWT Late Fragments", late_, "Fragments", 3, artdaq::MetricMode::LastPoint);
+		metricMan->sendMetric(prefix + "EWT Playback Loops", wraps_, "loops", 3, artdaq::MetricMode::LastPoint);
+		if (window_ > 0) metricMan->sendMetric(prefix + "EWT Reorder Buffer", buffer_.size(), "Fragments", 3, artdaq::MetricMode::Average | artdaq::MetricMode::Maximum);
+	}
+
+	// The last push() dropped its Fragment as a duplicate
+	bool dropped() const { return dropped_; }
+
+	size_t gaps() const { return gaps_; }
+	size_t duplicates() const { return duplicates_; }
+	size_t late() const { return late_; }
+	size_t wraps() const { return wraps_; }
+	size_t buffered() const { return buffer_.size(); }
+
+private:
+	void emit_(artdaq::FragmentPtrs& output)
+	{
+		auto it = buffer_.begin();
+		if (have_emitted_ && it->first > last_emitted_ + step_)
+		{
+			size_t missing = (it->first - last_emitted_) / step_ - 1;
+			gaps_ += missing;
+			// Remember the most recent missing slots, so a late arrival can take its gap back
+			for (size_t ii = missing - std::min(missing, missing_depth_); ii < missing; ++ii) missing_.insert(last_emitted_ + (ii + 1) * step_);
+			while (missing_.size() > missing_depth_) missing_.erase(missing_.begin());
+		}
+		last_emitted_ = it->first;
+		have_emitted_ = true;
+		remember_(it->first);
+		release_(std::move(it->second), output);
+		buffer_.erase(it);
+	}
+
+	void remember_(uint64_t ts)
+	{
+		recent_.push_back(ts);
+		if (recent_.size() > recent_depth_) recent_.pop_front();
+	}
+
+	void release_(artdaq::FragmentPtr frag, artdaq::FragmentPtrs& output)
+	{
+		if (renumber_) frag->setSequenceID(sequence_ids_.front());
+		sequence_ids_.pop_front();
+		output.emplace_back(std::move(frag));
+	}
+
+	size_t window_;
+	uint64_t step_;
+	uint64_t wrap_distance_;
+
+	std::map<uint64_t, artdaq::FragmentPtr> buffer_;
+	std::deque<artdaq::Fragment::sequence_id_t> sequence_ids_;  // Read order
+	bool renumber_{true};
+	bool dropped_{false};
+	static constexpr size_t recent_depth_ = 64;
+	std::deque<uint64_t> recent_;  // Last timestamps released (late ones included), to tell duplicates from late arrivals
+	static constexpr size_t missing_depth_ = 4096;
+	std::set<uint64_t> missing_;  // Most recent timestamps counted in gaps_
+	bool have_raw_{false};
+	bool have_emitted_{false};
+	uint64_t highest_raw_{0};
+	uint64_t offset_{0};
+	uint64_t last_emitted_{0};
+	size_t gaps_{0};
+	size_t duplicates_{0};
+	size_t late_{0};
+	size_t wraps_{0};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
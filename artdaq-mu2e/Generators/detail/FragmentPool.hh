@@ -0,0 +1,143 @@
+#ifndef artdaq_mu2e_Generators_detail_FragmentPool_hh
+#define artdaq_mu2e_Generators_detail_FragmentPool_hh
+
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-mu2e/Generators/detail/SPSCRing.hh"
+#include "artdaq-mu2e/Generators/detail/ThreadPlacement.hh"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+namespace mu2e {
+namespace detail {
+
+// Keeps a stock of Fragments already allocated and faulted in, so the readout path rarely waits on
+// the allocator or on first-touch page faults. Fragments are owned by artdaq once they are sent and
+// never come back, so a background thread replaces each one taken. The first stock is allocated at
+// max_payload_bytes; replacements are sized from the largest recent payload plus 25% headroom (a peak
+// that decays slowly), so the refill costs about what the events themselves do rather than the maximum
+// Fragment size per event. Only one byte per page is written to fault the pages in.
+//
+// huge_pages is a hint: MADV_HUGEPAGE on the page-aligned part of each payload, which only helps when
+// that spans whole huge pages and transparent huge pages are in madvise mode.
+class FragmentPool
+{
+public:
+	// numa_node >= 0 places the pooled payloads on that node
+	FragmentPool(size_t count, size_t max_payload_bytes, bool huge_pages, int numa_node = -1)
+		: stock_(count)
+		, max_payload_bytes_(max_payload_bytes)
+		, huge_pages_(huge_pages)
+		, numa_node_(numa_node)
+	{
+		// Nothing is known about event sizes yet
+		while (stock_.push(allocate_(max_payload_bytes_))) {}
+		running_ = true;
+		thread_ = std::thread(&FragmentPool::run_, this);
+	}
+
+	~FragmentPool()
+	{
+		running_ = false;
+		if (thread_.joinable()) thread_.join();
+	}
+
+	// Only one thread may call take(). Returns a Fragment resized to payload_bytes. When the pool is empty,
+	// or the payload is larger than the pooled Fragment was allocated for, that counts as a miss and the
+	// Fragment is allocated (or grown) on the spot.
+	artdaq::FragmentPtr take(size_t payload_bytes)
+	{
+		observe_(payload_bytes);
+		Entry entry;
+		if (payload_bytes > max_payload_bytes_ || !stock_.pop(entry))
+		{
+			++misses_;
+			return artdaq::Fragment::FragmentBytes(payload_bytes);
+		}
+		if (payload_bytes > entry.capacity) ++misses_;
+		entry.frag->resizeBytes(payload_bytes);  // Shrinking keeps the existing allocation
+		return std::move(entry.frag);
+	}
+
+	size_t available() const { return stock_.size(); }
+	size_t misses() const { return misses_; }
+
+	// Payload size replacements are currently allocated at
+	size_t refillBytes() const
+	{
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t bytes = observed_bytes_.load(std::memory_order_relaxed);
+		bytes = (bytes + bytes / 4 + page - 1) & ~(page - 1);
+		return std::min(std::max(bytes, page), max_payload_bytes_);
+	}
+
+private:
+	struct Entry
+	{
+		artdaq::FragmentPtr frag;
+		size_t capacity{0};  // Payload bytes allocated and faulted in
+	};
+
+	// Peak of recent payload sizes, decaying by 1/1024 per take
+	void observe_(size_t payload_bytes)
+	{
+		size_t peak = observed_bytes_.load(std::memory_order_relaxed);
+		peak -= peak >> 10;
+		observed_bytes_.store(std::max(peak, payload_bytes), std::memory_order_relaxed);
+	}
+
+	Entry allocate_(size_t payload_bytes)
+	{
+		Entry entry{artdaq::Fragment::FragmentBytes(payload_bytes), payload_bytes};
+		// Placement hints only apply to the page-aligned part of the payload
+		size_t page = sysconf(_SC_PAGESIZE);
+		auto data = entry.frag->dataBeginBytes();
+		auto begin = (reinterpret_cast<uintptr_t>(data) + page - 1) & ~(page - 1);
+		auto end = (reinterpret_cast<uintptr_t>(data) + payload_bytes) & ~(page - 1);
+		if (end > begin)
+		{
+			if (huge_pages_) madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+			bindToNumaNode(reinterpret_cast<void*>(begin), end - begin, numa_node_);
+		}
+		// Fault the pages in now rather than during readout
+		for (size_t offset = 0; offset < payload_bytes; offset += page) data[offset] = 0;
+		if (payload_bytes > 0) data[payload_bytes - 1] = 0;
+		return entry;
+	}
+
+	void refill_()
+	{
+		while (stock_.size() < stock_.capacity())
+		{
+			if (!stock_.push(allocate_(refillBytes()))) break;
+		}
+	}
+
+	void run_()
+	{
+		while (running_)
+		{
+			refill_();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	SPSCRing<Entry> stock_;
+	size_t max_payload_bytes_;
+	bool huge_pages_;
+	int numa_node_;
+	std::atomic<size_t> observed_bytes_{0};
+	std::atomic<size_t> misses_{0};
+	std::atomic<bool> running_{false};
+	std::thread thread_;
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef artdaq_mu2e_Generators_detail_FragmentPrefetcher_hh
+#define artdaq_mu2e_Generators_detail_FragmentPrefetcher_hh
+
+#include "artdaq-core/Data/Fragment.hh"
+#include "artdaq-mu2e/Generators/detail/SPSCRing.hh"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Runs a readout function on its own thread and hands the Fragments it produces to the
+// generator thread through an SPSCRing, so DTC reads overlap with artdaq's send path.
+class FragmentPrefetcher
+{
+public:
+	using reader_t = std::function<bool(artdaq::FragmentPtrs&)>;
+
+	explicit FragmentPrefetcher(size_t depth)
+		: ring_(depth) {}
+
+	~FragmentPrefetcher() { stop(); }
+
+	// The reader returns false when readout should end (stop requested or DTC error). Anything left over
+	// from the previous run is discarded.
+	void start(reader_t reader)
+	{
+		stop();
+		Entry discard;
+		while (ring_.pop(discard)) {}
+		overflow_.clear();
+		reader_ = std::move(reader);
+		reader_done_ = false;
+		running_ = true;
+		thread_ = std::thread(&FragmentPrefetcher::run_, this);
+	}
+
+	// Join the reader thread. Fragments it has produced are kept for drain(), which keeps handing them
+	// out after should_stop() and returns false only once they are all gone.
+	void stop()
+	{
+		running_ = false;
+		if (thread_.joinable()) thread_.join();
+	}
+
+	// Move all ready Fragments into output, waiting up to max_wait for the first one. If oldest is
+	// given and Fragments were drained, it is set to when the first of them was queued.
+	// Returns false once the reader has finished and everything it produced has been drained.
+	bool drain(artdaq::FragmentPtrs& output, std::chrono::microseconds max_wait, std::chrono::steady_clock::time_point* oldest = nullptr)
+	{
+		auto deadline = std::chrono::steady_clock::now() + max_wait;
+		Entry entry;
+		while (!ring_.pop(entry))
+		{
+			if (reader_done_.load(std::memory_order_acquire))
+			{
+				// The reader may have pushed its last Fragments just before finishing
+				if (ring_.pop(entry)) break;
+				return drainOverflow_(output, oldest);
+			}
+			if (std::chrono::steady_clock::now() >= deadline) return true;
+			std::this_thread::sleep_for(std::chrono::microseconds(20));
+		}
+		if (oldest != nullptr) *oldest = entry.queued;
+		do
+		{
+			output.emplace_back(std::move(entry.frag));
+		} while (ring_.pop(entry));
+		if (reader_done_.load(std::memory_order_acquire)) drainOverflow_(output, nullptr);
+		return true;
+	}
+
+	size_t depth() const { return ring_.capacity(); }
+	size_t fill() const { return ring_.size(); }
+
+private:
+	void run_()
+	{
+		while (running_)
+		{
+			artdaq::FragmentPtrs frags;
+			bool ok = reader_(frags);
+			auto queued = std::chrono::steady_clock::now();
+			for (auto& frag : frags)
+			{
+				Entry entry{std::move(frag), queued};
+				// Once one Fragment is set aside the rest follow it, so drain() keeps them in order
+				while (!overflow_.empty() || !ring_.push(std::move(entry)))
+				{
+					if (!running_ || !overflow_.empty())
+					{
+						// stop() is waiting on this thread and may hold the generator mutex, so the ring is not drained
+						overflow_.emplace_back(std::move(entry));
+						break;
+					}
+					std::this_thread::sleep_for(std::chrono::microseconds(20));
+				}
+			}
+			if (!ok) break;
+		}
+		reader_done_.store(true, std::memory_order_release);
+	}
+
+	struct Entry
+	{
+		artdaq::FragmentPtr frag;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	// Only called once reader_done_ is seen, so the reader thread no longer touches overflow_
+	bool drainOverflow_(artdaq::FragmentPtrs& output, std::chrono::steady_clock::time_point* oldest)
+	{
+		if (overflow_.empty()) return false;
+		if (oldest != nullptr) *oldest = overflow_.front().queued;
+		for (auto& entry : overflow_) output.emplace_back(std::move(entry.frag));
+		overflow_.clear();
+		return true;
+	}
+
+	SPSCRing<Entry> ring_;
+	std::vector<Entry> overflow_;  // Fragments the reader produced after stop() while the ring was full
+	reader_t reader_;
+	std::thread thread_;
+	std::atomic<bool> running_{false};
+	std::atomic<bool> reader_done_{false};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef artdaq_mu2e_Generators_detail_LatencyHistogram_hh
+#define artdaq_mu2e_Generators_detail_LatencyHistogram_hh
+
+#include "artdaq/DAQdata/Globals.hh"
+#include "fhiclcpp/ParameterSet.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace mu2e {
+namespace detail {
+
+// Fixed-bucket latency histogram that any number of threads can fill without locking. Buckets are
+// log-linear: 8 per power of two from 1 us to about 137 s (about 9% resolution), plus an underflow
+// and an overflow bucket, so percentiles come out to within one bucket width.
+class LatencyHistogram
+{
+public:
+	static constexpr int kSubBits = 3;
+	static constexpr int kMinExp = 10;  // 2^10 ns ~ 1 us
+	static constexpr int kMaxExp = 37;  // 2^37 ns ~ 137 s
+	static constexpr size_t kBuckets = (kMaxExp - kMinExp + 1) * (1 << kSubBits) + 2;
+
+	using Counts = std::array<uint64_t, kBuckets>;
+
+	void record(std::chrono::steady_clock::duration latency)
+	{
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+		buckets_[bucketOf_(ns > 0 ? static_cast<uint64_t>(ns) : 0)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void snapshot(Counts& counts) const
+	{
+		for (size_t ii = 0; ii < kBuckets; ++ii) counts[ii] = buckets_[ii].load(std::memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+	}
+
+	static uint64_t total(Counts const& counts)
+	{
+		uint64_t sum = 0;
+		for (auto count : counts) sum += count;
+		return sum;
+	}
+
+	// Upper edge, in seconds, of the bucket holding quantile q (0 < q <= 1); 0 if counts is empty
+	static double quantile(Counts const& counts, double q)
+	{
+		uint64_t n = total(counts);
+		if (n == 0) return 0;
+		uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * n + 0.5));
+		uint64_t seen = 0;
+		for (size_t ii = 0; ii < kBuckets; ++ii)
+		{
+			seen += counts[ii];
+			if (seen >= rank) return upperEdgeNs_(ii) * 1e-9;
+		}
+		return upperEdgeNs_(kBuckets - 1) * 1e-9;
+	}
+
+private:
+	static size_t bucketOf_(uint64_t ns)
+	{
+		if (ns < (uint64_t(1) << kMinExp)) return 0;
+		int exp = 63 - __builtin_clzll(ns);
+		if (exp > kMaxExp) return kBuckets - 1;
+		size_t sub = (ns >> (exp - kSubBits)) & ((1 << kSubBits) - 1);
+		return 1 + (exp - kMinExp) * (1 << kSubBits) + sub;
+	}
+
+	static double upperEdgeNs_(size_t bucket)
+	{
+		if (bucket == 0) return static_cast<double>(uint64_t(1) << kMinExp);
+		if (bucket == kBuckets - 1) return static_cast<double>(uint64_t(1) << (kMaxExp + 1));
+		size_t exp = kMinExp + (bucket - 1) / (1 << kSubBits);
+		size_t sub = (bucket - 1) % (1 << kSubBits);
+		return static_cast<double>(uint64_t(1) << exp) * (1 + (sub + 1) / static_cast<double>(1 << kSubBits));
+	}
+
+	std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+};
+
+// Latency histograms for the stages of a DTC receiver. record() may be called from any readout thread;
+// publish() and dump() from the generator thread only. Every latency_metrics_interval_ms, publish()
+// sends p50/p99/p99.9 of the latencies recorded since the previous publish; dump() summarizes the run.
+class StageLatencies
+{
+public:
+	enum Stage
+	{
+		RequestToData,  // CFO request sent until its event window is read out
+		Read,           // DTC read call, including waiting for data
+		Copy,           // Building Fragments from the DMA buffer
+		Emit,           // Fragment built until getNext_ hands it to artdaq
+		kStages
+	};
+
+	explicit StageLatencies(fhicl::ParameterSet const& ps)
+		: interval_(ps.get<size_t>("latency_metrics_interval_ms", 10000))
+	{}
+
+	void record(Stage stage, std::chrono::steady_clock::duration latency) { histograms_[stage].record(latency); }
+	void record(Stage stage, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) { record(stage, end - begin); }
+
+	void reset()
+	{
+		for (size_t ii = 0; ii < kStages; ++ii)
+		{
+			histograms_[ii].reset();
+			published_[ii].fill(0);
+		}
+		lastPublish_ = std::chrono::steady_clock::now();
+	}
+
+	void publish(std::string const& prefix = "")
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (now - lastPublish_ < interval_) return;
+		lastPublish_ = now;
+
+		LatencyHistogram::Counts counts;
+		for (size_t ii = 0; ii < kStages; ++ii)
+		{
+			histograms_[ii].snapshot(counts);
+			LatencyHistogram::Counts delta;
+			for (size_t bb = 0; bb < LatencyHistogram::kBuckets; ++bb) delta[bb] = counts[bb] - published_[ii][bb];
+			published_[ii] = counts;
+			if (LatencyHistogram::total(delta) == 0) continue;
+
+			auto name = prefix + names_[ii] + " Latency";
+			metricMan->sendMetric(name + " p50", LatencyHistogram::quantile(delta, 0.5), "s", 3, artdaq::MetricMode::LastPoint);
+			metricMan->sendMetric(name + " p99", LatencyHistogram::quantile(delta, 0.99), "s", 3, artdaq::MetricMode::LastPoint);
+			metricMan->sendMetric(name + " p99.9", LatencyHistogram::quantile(delta, 0.999), "s", 3, artdaq::MetricMode::LastPoint);
+		}
+	}
+
+	// One line per stage with the whole run's count and percentiles, for the log at stop()
+	std::string dump() const
+	{
+		std::ostringstream out;
+		LatencyHistogram::Counts counts;
+		for (size_t ii = 0; ii < kStages; ++ii)
+		{
+			histograms_[ii].snapshot(counts);
+			auto n = LatencyHistogram::total(counts);
+			if (n == 0) continue;
+			out << std::endl
+				<< std::setw(16) << names_[ii] << ": n=" << n << std::setprecision(3)
+				<< " p50=" << LatencyHistogram::quantile(counts, 0.5) * 1e6 << "us"
+				<< " p99=" << LatencyHistogram::quantile(counts, 0.99) * 1e6 << "us"
+				<< " p99.9=" << LatencyHistogram::quantile(counts, 0.999) * 1e6 << "us"
+				<< " max<=" << LatencyHistogram::quantile(counts, 1.0) * 1e6 << "us";
+		}
+		return out.str();
+	}
+
+private:
+	static constexpr const char* names_[kStages] = {"Request to Data", "DTC Read", "Fragment Copy", "Fragment Emit"};
+
+	std::chrono::milliseconds interval_;
+	std::chrono::steady_clock::time_point lastPublish_{std::chrono::steady_clock::now()};
+	std::array<LatencyHistogram, kStages> histograms_;
+	std::array<LatencyHistogram::Counts, kStages> published_{};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef artdaq_mu2e_Generators_detail_LinkMetricsPublisher_hh
+#define artdaq_mu2e_Generators_detail_LinkMetricsPublisher_hh
+
+#include "artdaq/DAQdata/Globals.hh"
+#include "dtcInterfaceLib/DTC.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Accumulates the per-link and per-ROC sub-event header metrics on the readout thread and
+// publishes them to the MetricManager from its own thread, so the readout path does no string
+// building or MetricManager calls per sub-event. Packet counts are kept per data block, for as
+// many blocks as a sub-event has (several ROCs may share a link).
+class LinkMetricsPublisher
+{
+public:
+	static constexpr size_t kLinks = 6;
+
+	LinkMetricsPublisher()
+	{
+		for (size_t ii = 0; ii < kLinks; ++ii)
+		{
+			link_status_names_[ii] = "ROC link" + std::to_string(ii) + " status";
+			link_latency_names_[ii] = "ROC link" + std::to_string(ii) + " latency";
+			roc_status_names_[ii] = "ROC " + std::to_string(ii) + " status";
+		}
+	}
+
+	~LinkMetricsPublisher() { stop(); }
+
+	void start(std::chrono::milliseconds interval)
+	{
+		stop();
+		interval_ = interval;
+		running_ = true;
+		thread_ = std::thread(&LinkMetricsPublisher::run_, this);
+	}
+
+	void stop()
+	{
+		{
+			std::unique_lock<std::mutex> lk(mutex_);
+			running_ = false;
+		}
+		cv_.notify_all();
+		if (thread_.joinable()) thread_.join();
+	}
+
+	void add(DTCLib::DTC_SubEvent& subevt)
+	{
+		auto hdr = subevt.GetHeader();
+		std::array<uint8_t, kLinks> status{{hdr->link0_status, hdr->link1_status, hdr->link2_status,
+											 hdr->link3_status, hdr->link4_status, hdr->link5_status}};
+		std::array<uint8_t, kLinks> latency{{hdr->link0_drp_rx_latency, hdr->link1_drp_rx_latency, hdr->link2_drp_rx_latency,
+											  hdr->link3_drp_rx_latency, hdr->link4_drp_rx_latency, hdr->link5_drp_rx_latency}};
+
+		std::unique_lock<std::mutex> lk(mutex_);
+		for (size_t ii = 0; ii < kLinks; ++ii)
+		{
+			current_.link_status[ii] = std::max<uint32_t>(current_.link_status[ii], status[ii]);
+			current_.latency_min[ii] = std::min<uint32_t>(current_.latency_min[ii], latency[ii]);
+			current_.latency_max[ii] = std::max<uint32_t>(current_.latency_max[ii], latency[ii]);
+		}
+		current_.subevents++;
+
+		for (size_t bl = 0; bl < subevt.GetDataBlockCount(); ++bl)
+		{
+			auto first = subevt.GetDataBlock(bl)->GetHeader();
+			// One entry per data block, however many ROCs share a link
+			if (bl >= current_.packets_sum.size())
+			{
+				current_.packets_sum.resize(bl + 1);
+				current_.packets_count.resize(bl + 1);
+			}
+			current_.packets_sum[bl] += first->GetPacketCount();
+			current_.packets_count[bl]++;
+			size_t link = first->GetLinkID();
+			if (link < kLinks)
+			{
+				current_.roc_status[link] = std::max<uint32_t>(current_.roc_status[link], first->GetStatus());
+				current_.roc_seen[link] = true;
+			}
+		}
+	}
+
+private:
+	struct Counters
+	{
+		size_t subevents{0};
+		std::array<uint32_t, kLinks> link_status{};
+		std::array<uint32_t, kLinks> latency_min{{UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX}};
+		std::array<uint32_t, kLinks> latency_max{};
+		std::vector<uint64_t> packets_sum;  // Indexed by data block
+		std::vector<uint64_t> packets_count;
+		std::array<uint32_t, kLinks> roc_status{};
+		std::array<bool, kLinks> roc_seen{};
+
+		// Start a new interval; the block count seen so far is kept, so add() rarely has to grow it
+		void clear()
+		{
+			Counters fresh;
+			fresh.packets_sum.assign(packets_sum.size(), 0);
+			fresh.packets_count.assign(packets_count.size(), 0);
+			*this = std::move(fresh);
+		}
+	};
+
+	void run_()
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		while (running_)
+		{
+			cv_.wait_for(lk, interval_, [&] { return !running_; });
+			Counters snapshot = current_;
+			current_.clear();
+			lk.unlock();
+			publish_(snapshot);
+			lk.lock();
+		}
+	}
+
+	void publish_(Counters const& c)
+	{
+		if (c.subevents == 0 || !metricMan) return;
+		for (size_t ii = 0; ii < kLinks; ++ii)
+		{
+			metricMan->sendMetric(link_status_names_[ii], static_cast<int>(c.link_status[ii]), "status", 3, artdaq::MetricMode::Maximum);
+			metricMan->sendMetric(link_latency_names_[ii], static_cast<int>(c.latency_min[ii]), "status", 3, artdaq::MetricMode::Minimum | artdaq::MetricMode::Maximum);
+			metricMan->sendMetric(link_latency_names_[ii], static_cast<int>(c.latency_max[ii]), "status", 3, artdaq::MetricMode::Minimum | artdaq::MetricMode::Maximum);
+			if (c.roc_seen[ii])
+			{
+				metricMan->sendMetric(roc_status_names_[ii], static_cast<int>(c.roc_status[ii]), "status", 3, artdaq::MetricMode::Maximum);
+			}
+		}
+		// Names are only built here, on the publishing thread, the first time a block index shows up
+		while (packets_names_.size() < c.packets_count.size()) packets_names_.push_back("Packets per ROC " + std::to_string(packets_names_.size()));
+		for (size_t bl = 0; bl < c.packets_count.size(); ++bl)
+		{
+			if (c.packets_count[bl] > 0)
+			{
+				metricMan->sendMetric(packets_names_[bl], static_cast<double>(c.packets_sum[bl]) / c.packets_count[bl], "Packages", 3, artdaq::MetricMode::Average);
+			}
+		}
+	}
+
+	std::array<std::string, kLinks> link_status_names_;
+	std::array<std::string, kLinks> link_latency_names_;
+	std::vector<std::string> packets_names_;  // Publishing thread only
+	std::array<std::string, kLinks> roc_status_names_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	Counters current_;
+	bool running_{false};
+	std::chrono::milliseconds interval_{1000};
+	std::thread thread_;
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef artdaq_mu2e_Generators_detail_MappedDTCFile_hh
+#define artdaq_mu2e_Generators_detail_MappedDTCFile_hh
+
+#include "dtcInterfaceLib/DTC.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace mu2e {
+namespace detail {
+
+// Private mapping of a raw DTC event file (DTC_Events back to back, as written by raw_output_enable or by
+// DTCEventDump without the detector emulator format), walked one event at a time. The mapping is writable
+// copy-on-write, so event headers can be patched in place without touching the file; only the pages that
+// are written get copied. Pages ahead of the cursor are read ahead as in MappedSTMFile, but pages behind it
+// are only released by releaseBefore(): dropping a private page also drops the patches made to it, so the
+// caller releases only what it has finished copying out.
+class MappedDTCFile
+{
+public:
+	struct Event
+	{
+		uint8_t* begin{nullptr};  // Start of the DTC_EventHeader
+		size_t bytes{0};          // inclusive_event_byte_count
+	};
+
+	MappedDTCFile(std::string const& path, size_t readahead_bytes)
+		: readahead_bytes_(std::max(readahead_bytes, size_t(1) << 20))
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			auto map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				map_ = static_cast<uint8_t*>(map);
+				size_ = st.st_size;
+				madvise(map_, size_, MADV_SEQUENTIAL);
+				rewind();
+			}
+		}
+		::close(fd);
+	}
+
+	~MappedDTCFile()
+	{
+		if (map_ != nullptr) munmap(map_, size_);
+	}
+
+	MappedDTCFile(MappedDTCFile const&) = delete;
+	MappedDTCFile& operator=(MappedDTCFile const&) = delete;
+
+	bool good() const { return map_ != nullptr; }
+	bool eof() const { return offset_ >= size_; }
+	bool truncated() const { return truncated_; }
+	size_t offset() const { return offset_; }
+	size_t size() const { return size_; }
+
+	// Start again from the first event (for looping). Every page is released first, so no patched copies stay
+	// resident and the second pass reads the file as recorded; no event from the previous pass may still be in use.
+	void rewind()
+	{
+		if (map_ != nullptr && released_ < size_) madvise(map_ + released_, size_ - released_, MADV_DONTNEED);
+		offset_ = 0;
+		released_ = 0;
+		truncated_ = false;
+		prefetched_ = std::min(readahead_bytes_, size_);
+		if (map_ != nullptr) madvise(map_, prefetched_, MADV_WILLNEED);
+	}
+
+	// Point evt at the next event. Returns false at the end of the file, or if the event header is cut
+	// off or claims more bytes than remain (or fewer than the header itself).
+	bool next(Event& evt)
+	{
+		constexpr size_t header_bytes = sizeof(DTCLib::DTC_EventHeader);
+		if (map_ == nullptr || offset_ >= size_) return false;
+		if (size_ - offset_ < header_bytes)
+		{
+			truncated_ = true;
+			return false;
+		}
+		DTCLib::DTC_EventHeader hdr;
+		memcpy(&hdr, map_ + offset_, header_bytes);
+		size_t bytes = hdr.inclusive_event_byte_count;
+		if (bytes < header_bytes || bytes > size_ - offset_)
+		{
+			truncated_ = true;
+			return false;
+		}
+		evt.begin = map_ + offset_;
+		evt.bytes = bytes;
+		offset_ += bytes;
+		advise_();
+		return true;
+	}
+
+	// Release the whole pages before offset (events there have been copied into Fragments). The page holding
+	// offset itself is kept, as the next event may start in it.
+	void releaseBefore(size_t offset)
+	{
+		static const size_t page = sysconf(_SC_PAGESIZE);
+		size_t done = std::min(offset, size_) & ~(page - 1);
+		if (map_ != nullptr && done > released_)
+		{
+			madvise(map_ + released_, done - released_, MADV_DONTNEED);
+			released_ = done;
+		}
+	}
+
+private:
+	void advise_()
+	{
+		if (offset_ + readahead_bytes_ / 2 > prefetched_ && prefetched_ < size_)
+		{
+			size_t len = std::min(readahead_bytes_, size_ - prefetched_);
+			madvise(map_ + prefetched_, len, MADV_WILLNEED);
+			prefetched_ += len;
+		}
+	}
+
+	uint8_t* map_{nullptr};
+	size_t size_{0};
+	size_t offset_{0};
+	size_t prefetched_{0};
+	size_t released_{0};
+	size_t readahead_bytes_;
+	bool truncated_{false};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
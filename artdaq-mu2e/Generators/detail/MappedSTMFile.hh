@@ -0,0 +1,134 @@
+#ifndef artdaq_mu2e_Generators_detail_MappedSTMFile_hh
+#define artdaq_mu2e_Generators_detail_MappedSTMFile_hh
+
+#include "artdaq-core-mu2e/Overlays/STMFragment.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace mu2e {
+namespace detail {
+
+// Read-only mapping of an STM raw file (a sequence of tHdr, sHdr, ADC samples), walked one slice at
+// a time. Pages ahead of the cursor are requested with MADV_WILLNEED and pages behind it are released,
+// so multi-GB files stream at disk speed without growing the resident set.
+class MappedSTMFile
+{
+public:
+	struct Slice
+	{
+		const uint8_t* begin{nullptr};  // Start of the tHdr
+		size_t bytes{0};                // tHdr + sHdr + samples
+		STMFragment::STM_tHdr tHdr;
+		STMFragment::STM_sHdr sHdr;
+	};
+
+	// slice_size_in_samples: sHdr.sliceSize() counts 16-bit ADC samples rather than bytes
+	MappedSTMFile(std::string const& path, size_t readahead_bytes, bool slice_size_in_samples)
+		: readahead_bytes_(std::max(readahead_bytes, size_t(1) << 20))
+		, sample_bytes_(slice_size_in_samples ? sizeof(uint16_t) : 1)
+	{
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			auto map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				map_ = static_cast<const uint8_t*>(map);
+				size_ = st.st_size;
+				madvise(const_cast<uint8_t*>(map_), size_, MADV_SEQUENTIAL);
+				madvise(const_cast<uint8_t*>(map_), std::min(readahead_bytes_, size_), MADV_WILLNEED);
+				prefetched_ = std::min(readahead_bytes_, size_);
+			}
+		}
+		::close(fd);
+	}
+
+	~MappedSTMFile()
+	{
+		if (map_ != nullptr) munmap(const_cast<uint8_t*>(map_), size_);
+	}
+
+	MappedSTMFile(MappedSTMFile const&) = delete;
+	MappedSTMFile& operator=(MappedSTMFile const&) = delete;
+
+	bool good() const { return map_ != nullptr; }
+	bool eof() const { return offset_ >= size_; }
+	bool truncated() const { return truncated_; }
+	size_t offset() const { return offset_; }
+	size_t size() const { return size_; }
+
+	// Point slice at the next slice in the file. Returns false at the end of the file, or if the
+	// remaining bytes are too few for the headers or for the sample count the slice header claims.
+	bool next(Slice& slice)
+	{
+		constexpr size_t header_bytes = sw_tHdr_size_bytes + sw_sHdr_size_bytes;
+		if (map_ == nullptr || offset_ >= size_) return false;
+		if (size_ - offset_ < header_bytes)
+		{
+			truncated_ = true;
+			return false;
+		}
+		memcpy(&slice.tHdr, map_ + offset_, sw_tHdr_size_bytes);
+		memcpy(&slice.sHdr, map_ + offset_ + sw_tHdr_size_bytes, sw_sHdr_size_bytes);
+		size_t payload = static_cast<size_t>(slice.sHdr.sliceSize()) * sample_bytes_;
+		if (payload > size_ - offset_ - header_bytes)
+		{
+			truncated_ = true;
+			return false;
+		}
+		slice.begin = map_ + offset_;
+		slice.bytes = header_bytes + payload;
+		offset_ += slice.bytes;
+		advise_();
+		return true;
+	}
+
+	// Step back over the slice just returned by next(), so the following next() returns it again
+	void unread(Slice const& slice)
+	{
+		offset_ = slice.begin - map_;
+		truncated_ = false;
+	}
+
+private:
+	void advise_()
+	{
+		static const size_t page = sysconf(_SC_PAGESIZE);
+		if (offset_ + readahead_bytes_ / 2 > prefetched_ && prefetched_ < size_)
+		{
+			size_t len = std::min(readahead_bytes_, size_ - prefetched_);
+			madvise(const_cast<uint8_t*>(map_ + prefetched_), len, MADV_WILLNEED);
+			prefetched_ += len;
+		}
+		// Drop what is well behind the cursor; slices already handed out have been copied into Fragments
+		size_t done = offset_ > readahead_bytes_ ? ((offset_ - readahead_bytes_) & ~(page - 1)) : 0;
+		if (done > released_)
+		{
+			madvise(const_cast<uint8_t*>(map_ + released_), done - released_, MADV_DONTNEED);
+			released_ = done;
+		}
+	}
+
+	const uint8_t* map_{nullptr};
+	size_t size_{0};
+	size_t offset_{0};
+	size_t prefetched_{0};
+	size_t released_{0};
+	size_t readahead_bytes_;
+	size_t sample_bytes_;
+	bool truncated_{false};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
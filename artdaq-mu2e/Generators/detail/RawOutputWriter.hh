@@ -0,0 +1,356 @@
+#ifndef artdaq_mu2e_Generators_detail_RawOutputWriter_hh
+#define artdaq_mu2e_Generators_detail_RawOutputWriter_hh
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Writes raw events to disk from a background thread. Events are appended to large
+// aligned buffers; full buffers are queued to the writer thread and recycled once written.
+// If no buffer is free when one is needed, the drop policy decides what is lost: the new
+// event (default), the oldest queued buffer, or nothing (readout waits for the disk).
+// Files are rotated at event boundaries once they reach rotate_bytes or rotate_seconds.
+class RawOutputWriter
+{
+public:
+	enum class DropPolicy
+	{
+		DropNewest,  // Drop the event being written; what is already queued reaches disk
+		DropOldest,  // Discard the oldest queued buffer; a new file starts at the gap (the old one may end mid-event)
+		Block,       // Wait for the writer thread; never drops, but a slow disk stalls readout
+	};
+
+	// "newest", "oldest" or "block"; anything else is DropNewest
+	static DropPolicy parseDropPolicy(std::string const& name)
+	{
+		if (name == "oldest") return DropPolicy::DropOldest;
+		if (name == "block") return DropPolicy::Block;
+		return DropPolicy::DropNewest;
+	}
+
+	struct Config
+	{
+		std::string file_name;         // First file; later files get _1, _2, ... before ".bin"
+		size_t buffer_bytes{16 << 20};  // Rounded up to a multiple of the O_DIRECT alignment
+		size_t buffer_count{2};
+		bool direct_io{false};
+		size_t rotate_bytes{0};    // 0 disables size-based rotation
+		size_t rotate_seconds{0};  // 0 disables time-based rotation
+		DropPolicy drop_policy{DropPolicy::DropNewest};
+	};
+
+	explicit RawOutputWriter(Config const& config)
+		: config_(config)
+		, buffer_bytes_((std::max(config.buffer_bytes, alignment_) + alignment_ - 1) & ~(alignment_ - 1))
+	{
+		buffers_.resize(std::max(config.buffer_count, size_t(2)));
+		for (auto& buf : buffers_)
+		{
+			buf.data = static_cast<uint8_t*>(std::aligned_alloc(alignment_, buffer_bytes_));
+			free_.push_back(&buf);
+		}
+		current_ = free_.front();
+		free_.pop_front();
+		file_start_ = std::chrono::steady_clock::now();
+		thread_ = std::thread(&RawOutputWriter::run_, this);
+	}
+
+	~RawOutputWriter()
+	{
+		close();
+		for (auto& buf : buffers_) std::free(buf.data);
+	}
+
+	// Called from the readout thread only. Returns false if the event was dropped.
+	bool write(const void* data, size_t bytes)
+	{
+		if (current_ == nullptr) return false;
+		if (bytes == 0) return true;
+
+		auto now = std::chrono::steady_clock::now();
+		bool rotate = file_bytes_ > 0 &&
+					  ((config_.rotate_bytes > 0 && file_bytes_ + bytes > config_.rotate_bytes) ||
+					   (config_.rotate_seconds > 0 && now - file_start_ >= std::chrono::seconds(config_.rotate_seconds)));
+
+		size_t space = rotate ? buffer_bytes_ : buffer_bytes_ - current_->used;
+		size_t needed = (rotate ? 1 : 0) + (bytes > space ? (bytes - space + buffer_bytes_ - 1) / buffer_bytes_ : 0);
+		if (needed > 0 && !reserve_(needed))
+		{
+			++dropped_;
+			return false;
+		}
+
+		if (rotate)
+		{
+			current_->end_of_file = true;
+			handoff_(true);
+			file_bytes_ = 0;
+			file_start_ = now;
+		}
+
+		if (current_->used == buffer_bytes_) handoff_(true);
+		if (current_->first_event == npos_) current_->first_event = current_->used;
+		++current_->events;
+
+		auto ptr = static_cast<const uint8_t*>(data);
+		size_t remaining = bytes;
+		while (remaining > 0)
+		{
+			if (current_->used == buffer_bytes_) handoff_(true);
+			auto chunk = std::min(remaining, buffer_bytes_ - current_->used);
+			memcpy(current_->data + current_->used, ptr, chunk);
+			current_->used += chunk;
+			ptr += chunk;
+			remaining -= chunk;
+		}
+		file_bytes_ += bytes;
+		return true;
+	}
+
+	// Flush everything still buffered and wait for the writer thread to finish
+	void close()
+	{
+		if (current_ != nullptr)
+		{
+			current_->end_of_file = true;
+			handoff_(false);
+		}
+		{
+			std::unique_lock<std::mutex> lk(mutex_);
+			stopping_ = true;
+		}
+		cv_.notify_all();
+		if (thread_.joinable()) thread_.join();
+	}
+
+	size_t queue_depth() const
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		return full_.size();
+	}
+	size_t dropped() const { return dropped_; }
+	size_t bytes_written() const { return bytes_written_; }
+	size_t write_errors() const { return write_errors_; }
+
+private:
+	static constexpr size_t npos_{static_cast<size_t>(-1)};
+
+	struct Buffer
+	{
+		uint8_t* data{nullptr};
+		size_t used{0};
+		size_t events{0};            // Events starting in this buffer
+		size_t first_event{npos_};  // Offset of the first event starting in this buffer
+		bool resync{false};          // An earlier buffer was discarded; skip bytes before first_event
+		bool end_of_file{false};
+	};
+
+	// Make sure needed buffers are free, applying the drop policy. Readout thread only.
+	bool reserve_(size_t needed)
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		if (free_.size() >= needed) return true;
+		if (needed >= buffers_.size()) return false;  // Larger than the writer can ever hold
+
+		switch (config_.drop_policy)
+		{
+			case DropPolicy::DropNewest:
+				return false;
+			case DropPolicy::DropOldest:
+				while (free_.size() < needed && !full_.empty())
+				{
+					auto buf = full_.front();
+					full_.pop_front();
+					dropped_ += buf->events;
+					// Start a new file at the gap, from the first whole event after it
+					close_pending_ = true;
+					auto next = full_.empty() ? current_ : full_.front();
+					next->resync = true;
+					recycle_(*buf);
+				}
+				return free_.size() >= needed;
+			case DropPolicy::Block:
+				cv_.wait(lk, [&] { return free_.size() >= needed; });
+				return true;
+		}
+		return false;
+	}
+
+	void recycle_(Buffer& buf)
+	{
+		buf.used = 0;
+		buf.events = 0;
+		buf.first_event = npos_;
+		buf.resync = false;
+		buf.end_of_file = false;
+		free_.push_back(&buf);
+	}
+
+	void handoff_(bool replace)
+	{
+		{
+			std::unique_lock<std::mutex> lk(mutex_);
+			full_.push_back(current_);
+			current_ = nullptr;
+			if (replace)
+			{
+				current_ = free_.front();  // write() checked that enough buffers are free
+				free_.pop_front();
+			}
+		}
+		cv_.notify_all();
+	}
+
+	void run_()
+	{
+		while (true)
+		{
+			Buffer* buf;
+			bool close_first;
+			{
+				std::unique_lock<std::mutex> lk(mutex_);
+				cv_.wait(lk, [&] { return !full_.empty() || stopping_; });
+				if (full_.empty()) break;
+				buf = full_.front();
+				full_.pop_front();
+				close_first = close_pending_;
+				close_pending_ = false;
+			}
+
+			if (close_first) closeFile_();
+			if (buf->used > 0) writeBuffer_(*buf);
+			bool end_of_file = buf->end_of_file;
+
+			{
+				std::unique_lock<std::mutex> lk(mutex_);
+				recycle_(*buf);
+			}
+			cv_.notify_all();  // A Block-policy write() may be waiting for this buffer
+			if (end_of_file) closeFile_();
+		}
+		closeFile_();
+	}
+
+	void writeBuffer_(Buffer const& buf)
+	{
+		// The bytes before the first event belong to one whose start was discarded. If no event starts
+		// in this buffer at all, it is the middle of that event and skipping carries on into the next one.
+		if (buf.resync) skipping_ = true;
+		if (skipping_ && buf.first_event == npos_) return;
+
+		if (fd_ < 0) openFile_();
+		if (fd_ < 0)
+		{
+			++write_errors_;
+			return;
+		}
+
+		if (skipping_)
+		{
+			// Skipping leaves the file unaligned, so O_DIRECT is off for the rest of it
+			skipping_ = false;
+			if (config_.direct_io) fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+			writeAll_(buf.data + buf.first_event, buf.used - buf.first_event);
+			return;
+		}
+
+		// With O_DIRECT only whole aligned blocks can be written; a partial buffer only ever
+		// ends a file, so its tail is written after O_DIRECT is switched off.
+		size_t direct_bytes = config_.direct_io ? buf.used & ~(alignment_ - 1) : buf.used;
+		writeAll_(buf.data, direct_bytes);
+		if (direct_bytes < buf.used)
+		{
+			fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+			writeAll_(buf.data + direct_bytes, buf.used - direct_bytes);
+		}
+	}
+
+	void writeAll_(const uint8_t* ptr, size_t bytes)
+	{
+		while (bytes > 0)
+		{
+			auto ret = ::write(fd_, ptr, bytes);
+			if (ret < 0)
+			{
+				if (errno == EINTR) continue;
+				++write_errors_;
+				return;
+			}
+			ptr += ret;
+			bytes -= ret;
+			bytes_written_ += ret;
+		}
+	}
+
+	void openFile_()
+	{
+		std::string name = config_.file_name;
+		if (file_index_ > 0)
+		{
+			auto suffix = "_" + std::to_string(file_index_);
+			auto pos = name.find(".bin");
+			if (pos != std::string::npos)
+				name.insert(pos, suffix);
+			else
+				name += suffix;
+		}
+		++file_index_;
+		int flags = O_WRONLY | O_CREAT | O_APPEND;
+		if (config_.direct_io) flags |= O_DIRECT;
+		fd_ = ::open(name.c_str(), flags, 0644);
+	}
+
+	void closeFile_()
+	{
+		if (fd_ >= 0) ::close(fd_);
+		fd_ = -1;
+	}
+
+	static constexpr size_t alignment_{4096};
+
+	Config config_;
+	size_t buffer_bytes_;
+	std::vector<Buffer> buffers_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<Buffer*> free_;
+	std::deque<Buffer*> full_;
+	bool stopping_{false};
+	bool close_pending_{false};  // DropOldest discarded a buffer; the next one starts a new file
+
+	// Readout-thread state
+	Buffer* current_{nullptr};
+	size_t file_bytes_{0};
+	std::chrono::steady_clock::time_point file_start_;
+
+	// Writer-thread state
+	int fd_{-1};
+	size_t file_index_{0};
+	bool skipping_{false};  // Inside an event whose start was discarded
+
+	std::atomic<size_t> dropped_{0};
+	std::atomic<size_t> bytes_written_{0};
+	std::atomic<size_t> write_errors_{0};
+	std::thread thread_;
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef artdaq_mu2e_Generators_detail_ReadoutWaitStrategy_hh
+#define artdaq_mu2e_Generators_detail_ReadoutWaitStrategy_hh
+
+#include "artdaq/DAQdata/Globals.hh"
+#include "fhiclcpp/ParameterSet.h"
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace mu2e {
+namespace detail {
+
+// Decides how long to wait between empty DTC reads: a number of back-to-back polls, then
+// polls separated by sched_yield, then polls separated by a fixed sleep until the deadline (or,
+// without one, until data arrives; every caller also checks should_stop() between reads).
+// The defaults (6 spin polls, nothing else) reproduce the original fixed retry loop.
+//
+//   wait.begin();
+//   do { data = read(); } while (data.empty() && wait.next());
+//   wait.finish(!data.empty());
+class ReadoutWaitStrategy
+{
+public:
+	struct Config
+	{
+		size_t spin_polls{6};
+		size_t yield_polls{0};
+		std::chrono::microseconds sleep{0};     // 0 disables the sleep phase
+		std::chrono::microseconds deadline{0};  // Bounds the sleep phase; 0 leaves it unbounded
+	};
+
+	explicit ReadoutWaitStrategy(fhicl::ParameterSet const& ps)
+		: ReadoutWaitStrategy(Config{ps.get<size_t>("readout_spin_polls", 6),
+									 ps.get<size_t>("readout_yield_polls", 0),
+									 std::chrono::microseconds(ps.get<size_t>("readout_sleep_us", 0)),
+									 std::chrono::microseconds(ps.get<size_t>("readout_deadline_us", 0))}) {}
+
+	explicit ReadoutWaitStrategy(Config const& config)
+		: config_(config)
+	{
+		for (size_t ii = 0; ii < kBuckets; ++ii)
+		{
+			bucket_names_[ii] = ii + 1 < kBuckets ? "Time to First Data < " + std::to_string(bucketLimitUs_(ii)) + " us"
+												  : "Time to First Data >= " + std::to_string(bucketLimitUs_(ii - 1)) + " us";
+		}
+	}
+
+	void begin()
+	{
+		polls_ = 0;
+		start_ = std::chrono::steady_clock::now();
+	}
+
+	// Call after an empty read; waits according to the current phase and returns false once
+	// no further attempt should be made
+	bool next()
+	{
+		++polls_;
+		++empty_reads_;
+		if (polls_ < config_.spin_polls) return true;
+		if (polls_ < config_.spin_polls + config_.yield_polls)
+		{
+			std::this_thread::yield();
+			return true;
+		}
+		if (config_.sleep.count() > 0 &&
+			(config_.deadline.count() == 0 || std::chrono::steady_clock::now() - start_ + config_.sleep <= config_.deadline))
+		{
+			std::this_thread::sleep_for(config_.sleep);
+			return true;
+		}
+		return false;
+	}
+
+	void finish(bool got_data)
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (got_data)
+		{
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - start_).count();
+			size_t bucket = 0;
+			while (bucket + 1 < kBuckets && us >= static_cast<long long>(bucketLimitUs_(bucket))) ++bucket;
+			++histogram_[bucket];
+		}
+		else
+		{
+			++timeouts_;
+		}
+
+		if (now - last_report_ >= std::chrono::seconds(1)) report_(now);
+	}
+
+private:
+	static constexpr size_t kBuckets = 10;
+	static size_t bucketLimitUs_(size_t bucket) { return size_t(1) << (2 * bucket + 2); }  // 4 us, 16 us, ... ~262 ms
+
+	void report_(std::chrono::steady_clock::time_point now)
+	{
+		last_report_ = now;
+		if (!metricMan) return;
+		metricMan->sendMetric("Empty DTC Reads", empty_reads_, "reads", 3, artdaq::MetricMode::Accumulate | artdaq::MetricMode::Rate);
+		metricMan->sendMetric("DTC Read Timeouts", timeouts_, "reads", 3, artdaq::MetricMode::Accumulate);
+		for (size_t ii = 0; ii < kBuckets; ++ii)
+		{
+			metricMan->sendMetric(bucket_names_[ii], histogram_[ii], "reads", 3, artdaq::MetricMode::Accumulate);
+			histogram_[ii] = 0;
+		}
+		empty_reads_ = 0;
+		timeouts_ = 0;
+	}
+
+	Config config_;
+	size_t polls_{0};
+	std::chrono::steady_clock::time_point start_;
+	std::chrono::steady_clock::time_point last_report_{std::chrono::steady_clock::now()};
+
+	size_t empty_reads_{0};
+	size_t timeouts_{0};
+	std::array<size_t, kBuckets> histogram_{};
+	std::array<std::string, kBuckets> bucket_names_;
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef artdaq_mu2e_Generators_detail_RequestPacer_hh
+#define artdaq_mu2e_Generators_detail_RequestPacer_hh
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace mu2e {
+namespace detail {
+
+// Deadline-based token bucket for paced CFO requests. Each request is scheduled one period
+// after the previous one regardless of how long the readout took, so the achieved rate
+// converges on the target. Up to `burst` requests of credit can build up while readout is
+// slow. The last stretch before a deadline is spun rather than slept, for sub-microsecond
+// accuracy.
+class RequestPacer
+{
+public:
+	// rate_hz <= 0 disables pacing
+	RequestPacer(double rate_hz, size_t burst)
+		: period_ns_(rate_hz > 0 ? 1e9 / rate_hz : 0)
+		, burst_(std::max(burst, size_t(1))) {}
+
+	bool enabled() const { return period_ns_ > 0; }
+
+	void reset()
+	{
+		start_ = std::chrono::steady_clock::now();
+		next_ns_ = 0;
+		sent_ = 0;
+	}
+
+	// Wait until n more requests may be sent. Returns false if stop() became true while waiting.
+	template<typename StopFn>
+	bool acquire(size_t n, StopFn&& stop)
+	{
+		if (!enabled())
+		{
+			sent_ += n;
+			return true;
+		}
+
+		// Credit for time spent idle is capped at the burst allowance
+		auto now_ns = elapsedNs_();
+		next_ns_ = std::max(next_ns_, now_ns - (burst_ - 1) * period_ns_);
+
+		auto deadline = start_ + std::chrono::nanoseconds(static_cast<long long>(next_ns_));
+		while (true)
+		{
+			if (stop()) return false;
+			auto remaining = deadline - std::chrono::steady_clock::now();
+			if (remaining <= std::chrono::nanoseconds(0)) break;
+			if (remaining > kSpinThreshold)
+			{
+				std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(remaining - kSpinThreshold, kMaxSleep));
+			}
+		}
+
+		next_ns_ += n * period_ns_;
+		sent_ += n;
+		return true;
+	}
+
+	// Average request rate since reset()
+	double achievedRate() const
+	{
+		auto elapsed = elapsedNs_();
+		return elapsed > 0 ? sent_ * 1e9 / elapsed : 0;
+	}
+
+	double targetRate() const { return enabled() ? 1e9 / period_ns_ : 0; }
+
+private:
+	double elapsedNs_() const { return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_).count(); }
+
+	static constexpr std::chrono::microseconds kSpinThreshold{100};
+	static constexpr std::chrono::milliseconds kMaxSleep{10};  // So stop requests are noticed promptly
+
+	double period_ns_;
+	size_t burst_;
+	std::chrono::steady_clock::time_point start_{std::chrono::steady_clock::now()};
+	double next_ns_{0};  // Earliest send time of the next request, relative to start_
+	size_t sent_{0};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef artdaq_mu2e_Generators_detail_RequestPipeline_hh
+#define artdaq_mu2e_Generators_detail_RequestPipeline_hh
+
+#include "fhiclcpp/ParameterSet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace mu2e {
+namespace detail {
+
+// Keeps the software CFO up to requests_in_flight event windows ahead of readout, so the DTC is
+// already assembling the next windows while the current one is copied out. Windows are counted
+// from the start of the run; "read" is the number of windows readout has consumed.
+//
+// Flow control: DTCLib does not expose the DMA ring indices, so occupancy is estimated as the
+// windows in flight times the running average window size. With request_dma_budget_bytes set,
+// the depth is cut back so that estimate stays within the budget (but never below one window).
+class RequestPipeline
+{
+public:
+	explicit RequestPipeline(fhicl::ParameterSet const& ps)
+		: depth_(std::max(ps.get<size_t>("requests_in_flight", 1), size_t(1)))
+		, budget_bytes_(ps.get<size_t>("request_dma_budget_bytes", 0))
+	{}
+
+	void reset()
+	{
+		requested_ = 0;
+		avg_window_bytes_ = 0;
+		sent_.clear();
+	}
+
+	// Number of new requests to send so that at least min_ahead windows (and up to the allowed depth) are in flight
+	size_t toIssue(uint64_t read, size_t min_ahead = 1)
+	{
+		requested_ = std::max(requested_, read);  // Windows can arrive without a request of ours (e.g. a CFO restart)
+		size_t target = std::max(allowedDepth(), min_ahead);
+		size_t in_flight = inFlight(read);
+		return target > in_flight ? target - in_flight : 0;
+	}
+
+	// Index of the next window to request; requests for windows [next(), next() + n) were just sent
+	uint64_t next() const { return requested_; }
+	void issued(size_t n)
+	{
+		auto now = std::chrono::steady_clock::now();
+		for (size_t ii = 0; ii < n; ++ii) sent_.emplace_back(requested_++, now);
+	}
+
+	// Windows before read have been read out; fn gets the time from each one's request until now
+	template<typename Fn>
+	void completed(uint64_t read, Fn&& fn)
+	{
+		auto now = std::chrono::steady_clock::now();
+		while (!sent_.empty() && sent_.front().first < read)
+		{
+			fn(now - sent_.front().second);
+			sent_.pop_front();
+		}
+	}
+
+	// A read consumed windows totalling bytes
+	void received(size_t windows, size_t bytes)
+	{
+		if (windows == 0) return;
+		double per_window = static_cast<double>(bytes) / windows;
+		avg_window_bytes_ = avg_window_bytes_ > 0 ? avg_window_bytes_ + kAlpha * (per_window - avg_window_bytes_) : per_window;
+	}
+
+	// Readout came back empty: whatever is still outstanding is presumed lost and will be requested again
+	void abandon(uint64_t read)
+	{
+		requested_ = read;
+		sent_.clear();
+	}
+
+	size_t inFlight(uint64_t read) const { return requested_ > read ? requested_ - read : 0; }
+
+	size_t allowedDepth() const
+	{
+		if (budget_bytes_ == 0 || avg_window_bytes_ <= 0) return depth_;
+		return std::clamp(static_cast<size_t>(budget_bytes_ / avg_window_bytes_), size_t(1), depth_);
+	}
+
+	// Estimated bytes waiting in the DTC and its DMA buffers for windows already requested
+	double estimatedOccupancyBytes(uint64_t read) const { return inFlight(read) * avg_window_bytes_; }
+
+	size_t depth() const { return depth_; }
+
+private:
+	static constexpr double kAlpha{0.05};
+
+	size_t depth_;
+	size_t budget_bytes_;
+	uint64_t requested_{0};
+	double avg_window_bytes_{0};
+	std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> sent_;  // Window index and send time of requests in flight
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
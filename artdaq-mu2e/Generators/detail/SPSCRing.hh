@@ -0,0 +1,61 @@
+#ifndef artdaq_mu2e_Generators_detail_SPSCRing_hh
+#define artdaq_mu2e_Generators_detail_SPSCRing_hh
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Bounded single-producer/single-consumer ring. push() may only be called from one thread
+// and pop() from one (other) thread; neither blocks, callers decide how to wait.
+template<typename T>
+class SPSCRing
+{
+public:
+	explicit SPSCRing(size_t depth)
+		: slots_(depth + 1) {}
+
+	bool push(T&& item)
+	{
+		auto head = head_.load(std::memory_order_relaxed);
+		auto next = increment_(head);
+		if (next == tail_.load(std::memory_order_acquire)) return false;  // full
+		slots_[head] = std::move(item);
+		head_.store(next, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		auto tail = tail_.load(std::memory_order_relaxed);
+		if (tail == head_.load(std::memory_order_acquire)) return false;  // empty
+		item = std::move(slots_[tail]);
+		tail_.store(increment_(tail), std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const
+	{
+		auto head = head_.load(std::memory_order_acquire);
+		auto tail = tail_.load(std::memory_order_acquire);
+		return head >= tail ? head - tail : head + slots_.size() - tail;
+	}
+
+	size_t capacity() const { return slots_.size() - 1; }
+	bool empty() const { return size() == 0; }
+
+private:
+	size_t increment_(size_t idx) const { return idx + 1 == slots_.size() ? 0 : idx + 1; }
+
+	std::vector<T> slots_;
+	alignas(64) std::atomic<size_t> head_{0};  // Next slot the producer writes
+	alignas(64) std::atomic<size_t> tail_{0};  // Next slot the consumer reads
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
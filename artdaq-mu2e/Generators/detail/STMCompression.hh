@@ -0,0 +1,224 @@
+#ifndef artdaq_mu2e_Generators_detail_STMCompression_hh
+#define artdaq_mu2e_Generators_detail_STMCompression_hh
+
+#include "fhiclcpp/ParameterSet.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Compressed STM slices keep the STM fragment type and layout (tHdr, sHdr, then the samples), but the
+// samples are replaced by an encoded block described by this Fragment metadata. A Fragment without
+// this metadata (or with a different magic) carries raw samples.
+struct STMCompressedMetadata
+{
+	static constexpr uint32_t MAGIC = 0x5a4d5453;  // "STMZ"
+	static constexpr uint16_t CURRENT_VERSION = 1;
+
+	enum Flags : uint16_t
+	{
+		ZeroSuppressed = 0x1,  // Samples within threshold of the baseline were replaced by the baseline
+		DeltaBitPacked = 0x2,  // Samples are zig-zag deltas of (sample - baseline), bit-packed in blocks
+		StoredRaw = 0x4,       // Encoding did not pay off; samples (after zero suppression) are stored as int16_t
+	};
+
+	uint32_t magic{MAGIC};
+	uint16_t version{CURRENT_VERSION};
+	uint16_t flags{0};
+	int32_t baseline{0};
+	int32_t threshold{-1};
+	uint32_t n_samples{0};
+	uint32_t encoded_bytes{0};
+};
+
+// Baseline subtraction, threshold zero suppression and lossless delta + bit-packing for STM ADC samples.
+// Configured from an stm_compression table:
+//   enable:           false
+//   consumers_decode_compressed: false  (must be set with enable; see STMReceiver)
+//   zero_suppress:    true   (lossy: |sample - baseline| <= threshold becomes the baseline)
+//   threshold:        10     ADC counts
+//   baseline:         0      used when baseline_samples is 0
+//   baseline_samples: 32     baseline is the mean of the first N samples of each slice
+//   bitpack:          true
+// The per-sample loops are branch-free over contiguous arrays so the compiler can vectorize them.
+class STMCompressor
+{
+public:
+	static constexpr size_t BLOCK_SAMPLES = 128;
+
+	STMCompressor() = default;
+
+	explicit STMCompressor(fhicl::ParameterSet const& ps)
+		: enabled_(ps.get<bool>("enable", false))
+		, zero_suppress_(ps.get<bool>("zero_suppress", true))
+		, threshold_(ps.get<int>("threshold", 10))
+		, baseline_(ps.get<int>("baseline", 0))
+		, baseline_samples_(ps.get<size_t>("baseline_samples", 32))
+		, bitpack_(ps.get<bool>("bitpack", true))
+	{}
+
+	bool enabled() const { return enabled_; }
+
+	// Upper bound on encode()'s output for n samples
+	static size_t maxEncodedBytes(size_t n)
+	{
+		size_t blocks = (n + BLOCK_SAMPLES - 1) / BLOCK_SAMPLES;
+		return std::max(blocks * (1 + BLOCK_SAMPLES * sizeof(uint32_t)), n * sizeof(int16_t));
+	}
+
+	// Encode n samples (read with memcpy, so any alignment) into out, which must hold maxEncodedBytes(n).
+	// Returns the number of bytes written and fills md.
+	size_t encode(const void* samples, size_t n, uint8_t* out, STMCompressedMetadata& md)
+	{
+		values_.resize(n);
+		memcpy(values_.data(), samples, n * sizeof(int16_t));
+
+		int32_t baseline = baseline_;
+		if (baseline_samples_ > 0 && n > 0)
+		{
+			size_t count = std::min(baseline_samples_, n);
+			int64_t sum = 0;
+			for (size_t ii = 0; ii < count; ++ii) sum += values_[ii];
+			baseline = static_cast<int32_t>(sum / static_cast<int64_t>(count));
+		}
+
+		residuals_.resize(n);
+		const int32_t thr = zero_suppress_ ? threshold_ : -1;
+		for (size_t ii = 0; ii < n; ++ii)
+		{
+			int32_t r = values_[ii] - baseline;
+			residuals_[ii] = std::abs(r) > thr ? r : 0;
+		}
+
+		md = STMCompressedMetadata();
+		md.baseline = baseline;
+		md.threshold = thr;
+		md.n_samples = n;
+		if (zero_suppress_) md.flags |= STMCompressedMetadata::ZeroSuppressed;
+
+		size_t bytes = 0;
+		if (bitpack_)
+		{
+			bytes = pack_(out);
+			md.flags |= STMCompressedMetadata::DeltaBitPacked;
+		}
+		if (!bitpack_ || bytes >= n * sizeof(int16_t))
+		{
+			// Residuals came from int16_t samples, so adding the baseline back always fits
+			for (size_t ii = 0; ii < n; ++ii) values_[ii] = static_cast<int16_t>(residuals_[ii] + baseline);
+			bytes = n * sizeof(int16_t);
+			memcpy(out, values_.data(), bytes);
+			md.flags = (md.flags & ~STMCompressedMetadata::DeltaBitPacked) | STMCompressedMetadata::StoredRaw;
+		}
+		md.encoded_bytes = bytes;
+		return bytes;
+	}
+
+	// Offline helper: rebuild the samples of one compressed slice. Zero-suppressed samples come back as the
+	// baseline. Returns false if the metadata is not recognized or the encoded block is inconsistent.
+	static bool decode(STMCompressedMetadata const& md, const uint8_t* in, size_t bytes, std::vector<int16_t>& out)
+	{
+		if (md.magic != STMCompressedMetadata::MAGIC || md.version > STMCompressedMetadata::CURRENT_VERSION || md.encoded_bytes > bytes)
+		{
+			return false;
+		}
+		out.resize(md.n_samples);
+		if (md.flags & STMCompressedMetadata::StoredRaw)
+		{
+			if (md.encoded_bytes != md.n_samples * sizeof(int16_t)) return false;
+			memcpy(out.data(), in, md.encoded_bytes);
+			return true;
+		}
+		if (!(md.flags & STMCompressedMetadata::DeltaBitPacked)) return false;
+
+		size_t pos = 0;
+		int32_t prev = 0;
+		for (size_t first = 0; first < md.n_samples; first += BLOCK_SAMPLES)
+		{
+			size_t count = std::min(BLOCK_SAMPLES, static_cast<size_t>(md.n_samples) - first);
+			if (pos >= md.encoded_bytes) return false;
+			unsigned bits = in[pos++];
+			if (bits > 32 || pos + (count * bits + 7) / 8 > md.encoded_bytes) return false;
+
+			uint64_t acc = 0;
+			unsigned have = 0;
+			for (size_t ii = 0; ii < count; ++ii)
+			{
+				while (have < bits)
+				{
+					acc |= static_cast<uint64_t>(in[pos++]) << have;
+					have += 8;
+				}
+				uint32_t zz = bits == 0 ? 0 : static_cast<uint32_t>(acc & ((uint64_t(1) << bits) - 1));
+				acc >>= bits;
+				have -= bits;
+				int32_t delta = static_cast<int32_t>(zz >> 1) ^ -static_cast<int32_t>(zz & 1);
+				prev += delta;
+				out[first + ii] = static_cast<int16_t>(prev + md.baseline);
+			}
+		}
+		return true;
+	}
+
+private:
+	size_t pack_(uint8_t* out)
+	{
+		size_t n = residuals_.size();
+		zigzag_.resize(n);
+		int32_t prev = 0;
+		for (size_t ii = 0; ii < n; ++ii)
+		{
+			int32_t delta = residuals_[ii] - prev;
+			prev = residuals_[ii];
+			zigzag_[ii] = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+		}
+
+		size_t pos = 0;
+		for (size_t first = 0; first < n; first += BLOCK_SAMPLES)
+		{
+			size_t count = std::min(BLOCK_SAMPLES, n - first);
+			uint32_t all = 0;
+			for (size_t ii = 0; ii < count; ++ii) all |= zigzag_[first + ii];
+			unsigned bits = 0;
+			while (bits < 32 && (all >> bits) != 0) ++bits;
+			out[pos++] = static_cast<uint8_t>(bits);
+
+			uint64_t acc = 0;
+			unsigned have = 0;
+			for (size_t ii = 0; ii < count && bits > 0; ++ii)
+			{
+				acc |= static_cast<uint64_t>(zigzag_[first + ii]) << have;
+				have += bits;
+				while (have >= 8)
+				{
+					out[pos++] = static_cast<uint8_t>(acc);
+					acc >>= 8;
+					have -= 8;
+				}
+			}
+			if (have > 0) out[pos++] = static_cast<uint8_t>(acc);
+		}
+		return pos;
+	}
+
+	bool enabled_{false};
+	bool zero_suppress_{true};
+	int threshold_{10};
+	int baseline_{0};
+	size_t baseline_samples_{32};
+	bool bitpack_{true};
+
+	std::vector<int16_t> values_;
+	std::vector<int32_t> residuals_;
+	std::vector<uint32_t> zigzag_;
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef artdaq_mu2e_Generators_detail_SequenceIDWindow_hh
+#define artdaq_mu2e_Generators_detail_SequenceIDWindow_hh
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Remembers which of the last `window` sequence IDs (counting back from the highest seen) have
+// been seen, using one bit each in a ring. Lookups and inserts are O(1); moving the window
+// forward clears the bits it passes over.
+class SequenceIDWindow
+{
+public:
+	enum class Result
+	{
+		New,        // Not seen before; now recorded
+		Duplicate,  // Already seen within the window
+		Stale,      // Older than the window, so it cannot be checked
+	};
+
+	explicit SequenceIDWindow(size_t window)
+	{
+		size_t words = 1;
+		while (words * 64 < window) words *= 2;
+		bits_.assign(words, 0);
+		mask_ = words * 64 - 1;
+	}
+
+	Result insert(uint64_t seq)
+	{
+		if (!any_)
+		{
+			any_ = true;
+			highest_ = seq;
+		}
+		else if (seq > highest_)
+		{
+			if (seq - highest_ > mask_)
+			{
+				std::fill(bits_.begin(), bits_.end(), 0);
+			}
+			else
+			{
+				for (uint64_t id = highest_ + 1; id < seq; ++id) clear_(id);
+			}
+			highest_ = seq;
+			clear_(seq);
+		}
+		else if (highest_ - seq > mask_)
+		{
+			return Result::Stale;
+		}
+		else if (test_(seq))
+		{
+			return Result::Duplicate;
+		}
+		set_(seq);
+		return Result::New;
+	}
+
+	void reset()
+	{
+		std::fill(bits_.begin(), bits_.end(), 0);
+		any_ = false;
+		highest_ = 0;
+	}
+
+	size_t window() const { return mask_ + 1; }
+
+private:
+	bool test_(uint64_t id) const { return bits_[(id & mask_) >> 6] & (uint64_t(1) << (id & 63)); }
+	void set_(uint64_t id) { bits_[(id & mask_) >> 6] |= uint64_t(1) << (id & 63); }
+	void clear_(uint64_t id) { bits_[(id & mask_) >> 6] &= ~(uint64_t(1) << (id & 63)); }
+
+	std::vector<uint64_t> bits_;
+	uint64_t mask_;
+	bool any_{false};
+	uint64_t highest_{0};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef artdaq_mu2e_Generators_detail_SimFileUpload_hh
+#define artdaq_mu2e_Generators_detail_SimFileUpload_hh
+
+#include "artdaq/DAQdata/Globals.hh"
+#include "dtcInterfaceLib/DTC.h"
+#include "fhiclcpp/ParameterSet.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace mu2e {
+namespace detail {
+
+// Loads a simulation file into DTC DDR memory on a background thread.
+// The file is memory-mapped and hashed in chunks (which also pulls it into the page cache
+// ahead of WriteSimFileToDTC). The hash is recorded in a cache file once the upload completes,
+// together with the host boot ID: DDR does not survive a power cycle of the DTC, and the card cannot
+// be power cycled without rebooting its host. If the next configure finds the same hash and boot ID
+// for the same DTC, DDR already holds the file and the upload is skipped. Every ResetDDR() made by
+// the receivers deletes the cache (invalidateCache); a tool outside artdaq that rewrites DDR is not
+// visible from here, so sim_file_force_upload exists for that case.
+//   sim_file_cache:          cache file (default /tmp/mu2e_dtc<id>_sim_file.cache; with several cards, _dtc<id> is appended)
+//   sim_file_force_upload:   ignore the cache
+//   sim_file_chunk_bytes:    bytes hashed between progress reports
+class SimFileUpload
+{
+public:
+	SimFileUpload(fhicl::ParameterSet const& ps, int dtc_id, bool multi_card = false)
+		: cache_file_(cacheFile(ps, dtc_id, multi_card))
+		, force_(ps.get<bool>("sim_file_force_upload", false))
+		, chunk_bytes_(std::max(ps.get<size_t>("sim_file_chunk_bytes", 64 << 20), size_t(1) << 20))
+	{}
+
+	static std::string cacheFile(fhicl::ParameterSet const& ps, int dtc_id, bool multi_card = false)
+	{
+		auto id = std::to_string(std::max(dtc_id, 0));
+		auto file = ps.get<std::string>("sim_file_cache", "");
+		if (file.empty()) return "/tmp/mu2e_dtc" + id + "_sim_file.cache";
+		return multi_card ? file + "_dtc" + id : file;
+	}
+
+	// DDR is about to be reset outside of an upload; the cached hash no longer describes it
+	static void invalidateCache(fhicl::ParameterSet const& ps, int dtc_id, bool multi_card = false)
+	{
+		std::remove(cacheFile(ps, dtc_id, multi_card).c_str());
+	}
+
+	~SimFileUpload()
+	{
+		if (thread_.joinable()) thread_.join();
+	}
+
+	void start(DTCLib::DTC* dtc, std::string const& sim_file)
+	{
+		done_ = false;
+		thread_ = std::thread(&SimFileUpload::run_, this, dtc, sim_file);
+	}
+
+	// Wait for the upload to finish, checking stop() while waiting. Returns true once the file is loaded.
+	template<typename StopFn>
+	bool wait(StopFn&& stop)
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		while (!done_)
+		{
+			if (stop()) return false;
+			cv_.wait_for(lk, std::chrono::milliseconds(10));
+		}
+		return true;
+	}
+
+	bool done() const
+	{
+		std::unique_lock<std::mutex> lk(mutex_);
+		return done_;
+	}
+
+private:
+	void run_(DTCLib::DTC* dtc, std::string sim_file)
+	{
+		size_t size = 0;
+		uint64_t hash = hashFile_(sim_file, size);
+
+		auto boot_id = bootId_();
+		uint64_t cached_hash = 0;
+		size_t cached_size = 0;
+		std::string cached_boot_id;
+		std::string cached_file;
+		std::ifstream cache(cache_file_);
+		bool cached = !force_ && size > 0 && !boot_id.empty() && (cache >> cached_hash >> cached_size >> cached_boot_id >> cached_file) &&
+					  cached_hash == hash && cached_size == size && cached_boot_id == boot_id;
+		cache.close();
+
+		if (cached)
+		{
+			TLOG(TLVL_INFO) << "Simulation file " << sim_file << " (hash " << std::hex << hash << std::dec
+							<< ") is already in DTC memory, skipping upload";
+			dtc->SoftReset();
+			metricMan->sendMetric("Sim File Upload Skipped", 1, "uploads", 3, artdaq::MetricMode::LastPoint);
+		}
+		else
+		{
+			TLOG(TLVL_INFO) << "Starting read of simulation file " << sim_file << "."
+							<< " Please wait to start the run until finished.";
+			std::remove(cache_file_.c_str());  // DDR contents are unknown until the upload completes
+			auto start = std::chrono::steady_clock::now();
+			dtc->ResetDDR();
+			dtc->SoftReset();
+			dtc->WriteSimFileToDTC(sim_file, true);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			TLOG(TLVL_INFO) << "Done reading simulation file into DTC memory (" << size << " bytes in " << elapsed.count() << " s).";
+			metricMan->sendMetric("Sim File Upload Time", elapsed.count(), "s", 3, artdaq::MetricMode::LastPoint);
+			if (elapsed.count() > 0) metricMan->sendMetric("Sim File Upload Rate", size / elapsed.count(), "B/s", 3, artdaq::MetricMode::LastPoint);
+			metricMan->sendMetric("Sim File Upload Skipped", 0, "uploads", 3, artdaq::MetricMode::LastPoint);
+
+			if (size > 0 && !boot_id.empty())
+			{
+				std::ofstream out(cache_file_, std::ios::trunc);
+				out << hash << " " << size << " " << boot_id << " " << sim_file << std::endl;
+			}
+		}
+
+		{
+			std::unique_lock<std::mutex> lk(mutex_);
+			done_ = true;
+		}
+		cv_.notify_all();
+	}
+
+	// Changes on every boot of this host; empty if it cannot be read, which disables the cache
+	static std::string bootId_()
+	{
+		std::string id;
+		std::ifstream in("/proc/sys/kernel/random/boot_id");
+		in >> id;
+		return id;
+	}
+
+	// Map the file and hash it chunk by chunk, reporting progress. Returns 0 (and size 0) if the file cannot be mapped.
+	uint64_t hashFile_(std::string const& file, size_t& size)
+	{
+		size = 0;
+		int fd = open(file.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			TLOG(TLVL_WARNING) << "Cannot open simulation file " << file << ": " << strerror(errno);
+			return 0;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return 0;
+		}
+		auto map = static_cast<const uint8_t*>(mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+		::close(fd);
+		if (map == MAP_FAILED)
+		{
+			TLOG(TLVL_WARNING) << "Cannot map simulation file " << file << ": " << strerror(errno);
+			return 0;
+		}
+		size = st.st_size;
+		madvise(const_cast<uint8_t*>(map), size, MADV_SEQUENTIAL);
+
+		// FNV-1a over 64-bit words, with the size folded in so truncated files differ
+		uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+		for (size_t offset = 0; offset < size; offset += chunk_bytes_)
+		{
+			size_t chunk = std::min(chunk_bytes_, size - offset);
+			if (offset + chunk < size)
+			{
+				madvise(const_cast<uint8_t*>(map + offset + chunk), std::min(chunk_bytes_, size - offset - chunk), MADV_WILLNEED);
+			}
+			size_t ii = 0;
+			for (; ii + sizeof(uint64_t) <= chunk; ii += sizeof(uint64_t))
+			{
+				uint64_t word;
+				memcpy(&word, map + offset + ii, sizeof(word));
+				hash = (hash ^ word) * 0x100000001b3ULL;
+			}
+			for (; ii < chunk; ++ii)
+			{
+				hash = (hash ^ map[offset + ii]) * 0x100000001b3ULL;
+			}
+			metricMan->sendMetric("Sim File Hash Progress", 100.0 * (offset + chunk) / size, "%", 3, artdaq::MetricMode::LastPoint);
+		}
+		munmap(const_cast<uint8_t*>(map), size);
+		return hash;
+	}
+
+	std::string cache_file_;
+	bool force_;
+	size_t chunk_bytes_;
+	std::thread thread_;
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+	bool done_{true};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
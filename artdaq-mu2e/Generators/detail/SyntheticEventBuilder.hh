@@ -0,0 +1,278 @@
+#ifndef artdaq_mu2e_Generators_detail_SyntheticEventBuilder_hh
+#define artdaq_mu2e_Generators_detail_SyntheticEventBuilder_hh
+
+#include "dtcInterfaceLib/DTC.h"
+#include "fhiclcpp/ParameterSet.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Builds DTC_Events in software: one sub-event per DTC, one data block per ROC (rocs_per_link on each of
+// links_per_dtc links), with the packet count of each block drawn from the configured distribution. Event
+// and sub-event headers are filled in as the DTC writes them, and data block headers come from
+// DTC_DataHeaderPacket::ConvertToDataPacket.
+//
+// template_events events are generated up front and handed out in turn, so payloads repeat with that
+// period; next() only stamps the event window tag into each one, which keeps generation off the
+// critical path. An event returned by next() stays valid until template_events more calls.
+class SyntheticEventBuilder
+{
+public:
+	enum class Distribution
+	{
+		Fixed,        // Always packets_per_block
+		Uniform,      // Uniform in [packets_per_block_min, packets_per_block_max]
+		Poisson,      // Mean packets_per_block
+		Exponential,  // Mean packets_per_block (long tail of large blocks)
+	};
+
+	enum class Pattern
+	{
+		Counter,  // Each 16-bit payload word counts up within its block
+		Random,
+		Zero,
+	};
+
+	static Distribution parseDistribution(std::string const& name)
+	{
+		if (name == "uniform") return Distribution::Uniform;
+		if (name == "poisson") return Distribution::Poisson;
+		if (name == "exponential") return Distribution::Exponential;
+		return Distribution::Fixed;
+	}
+
+	static Pattern parsePattern(std::string const& name)
+	{
+		if (name == "random") return Pattern::Random;
+		if (name == "zero") return Pattern::Zero;
+		return Pattern::Counter;
+	}
+
+	struct Event
+	{
+		const uint8_t* begin{nullptr};
+		size_t bytes{0};
+	};
+
+	explicit SyntheticEventBuilder(fhicl::ParameterSet const& ps)
+		: n_dtcs_(std::clamp(ps.get<size_t>("synthetic_dtcs", 1), size_t(1), size_t(255)))
+		, first_dtc_id_(static_cast<uint8_t>(ps.get<size_t>("synthetic_first_dtc_id", 0)))
+		, links_(std::clamp(ps.get<size_t>("links_per_dtc", 6), size_t(1), size_t(6)))
+		, rocs_per_link_(std::max(ps.get<size_t>("rocs_per_link", 1), size_t(1)))
+		, subsystem_(static_cast<DTCLib::DTC_Subsystem>(ps.get<int>("subsystem", 0)))
+		, packet_version_(static_cast<uint8_t>(ps.get<size_t>("data_packet_version", 1)))
+		, distribution_(parseDistribution(ps.get<std::string>("packets_per_block_distribution", "fixed")))
+		, pattern_(parsePattern(ps.get<std::string>("payload_pattern", "counter")))
+		, mean_packets_(ps.get<double>("packets_per_block", 8))
+		, min_packets_(ps.get<size_t>("packets_per_block_min", 0))
+		, max_packets_(std::min(ps.get<size_t>("packets_per_block_max", 255), kMaxPacketsPerBlock))
+		, rng_(ps.get<uint64_t>("random_seed", 1))
+	{
+		min_packets_ = std::min(min_packets_, max_packets_);
+
+		// Keep the largest possible event within the 24-bit inclusive_event_byte_count
+		size_t blocks = n_dtcs_ * links_ * rocs_per_link_;
+		size_t fixed_bytes = sizeof(DTCLib::DTC_EventHeader) + n_dtcs_ * sizeof(DTCLib::DTC_SubEventHeader) + blocks * kPacketBytes;
+		size_t packet_room = fixed_bytes < kMaxEventBytes ? (kMaxEventBytes - fixed_bytes) / kPacketBytes / blocks : 0;
+		if (max_packets_ > packet_room)
+		{
+			max_packets_ = packet_room;
+			min_packets_ = std::min(min_packets_, max_packets_);
+			clamped_ = true;
+		}
+
+		size_t n_templates = std::max(ps.get<size_t>("template_events", 64), size_t(1));
+		templates_.resize(n_templates);
+		for (auto& tmpl : templates_) generate_(tmpl);
+	}
+
+	// Make sure at least n events handed out in a row are distinct buffers (e.g. all the events of one Fragment)
+	void reserveDistinct(size_t n)
+	{
+		while (templates_.size() < n)
+		{
+			templates_.emplace_back();
+			generate_(templates_.back());
+		}
+	}
+
+	// The next event, stamped with event window tag ewt in every header
+	Event next(uint64_t ewt)
+	{
+		auto& tmpl = templates_[next_];
+		next_ = (next_ + 1) % templates_.size();
+
+		uint8_t* base = tmpl.bytes.data();
+		DTCLib::DTC_EventHeader evt;
+		memcpy(&evt, base, sizeof(evt));
+		evt.event_tag_low = ewt & 0xFFFFFFFF;
+		evt.event_tag_high = (ewt >> 32) & 0xFFFF;
+		memcpy(base, &evt, sizeof(evt));
+		for (auto offset : tmpl.subevents)
+		{
+			DTCLib::DTC_SubEventHeader sub;
+			memcpy(&sub, base + offset, sizeof(sub));
+			sub.event_tag_low = ewt & 0xFFFFFFFF;
+			sub.event_tag_high = (ewt >> 32) & 0xFFFF;
+			memcpy(base + offset, &sub, sizeof(sub));
+		}
+		for (auto offset : tmpl.blocks)
+		{
+			for (size_t ii = 0; ii < kTagBytes; ++ii) base[offset + kBlockTagOffset + ii] = (ewt >> (8 * ii)) & 0xFF;
+		}
+		return {base, tmpl.bytes.size()};
+	}
+
+	bool clamped() const { return clamped_; }
+	size_t maxPacketsPerBlock() const { return max_packets_; }
+	size_t templateCount() const { return templates_.size(); }
+
+	// Average size of the generated events
+	double meanEventBytes() const
+	{
+		size_t sum = 0;
+		for (auto& tmpl : templates_) sum += tmpl.bytes.size();
+		return static_cast<double>(sum) / templates_.size();
+	}
+
+private:
+	static constexpr size_t kPacketBytes = 16;
+	static constexpr size_t kMaxPacketsPerBlock = 0x7FF;  // Width of the data header packet count
+	static constexpr size_t kMaxEventBytes = 0xFFFFFF;    // Width of inclusive_event_byte_count
+	static constexpr size_t kBlockTagOffset = 6;          // ConvertToDataPacket puts the 48-bit tag in bytes 6-11
+	static constexpr size_t kTagBytes = 6;
+
+	struct Template
+	{
+		std::vector<uint8_t> bytes;
+		std::vector<size_t> subevents;  // Offsets of the sub-event headers
+		std::vector<size_t> blocks;     // Offsets of the data block headers
+	};
+
+	size_t drawPackets_()
+	{
+		double packets = mean_packets_;
+		switch (distribution_)
+		{
+			case Distribution::Fixed:
+				break;
+			case Distribution::Uniform:
+				return std::uniform_int_distribution<size_t>(min_packets_, max_packets_)(rng_);
+			case Distribution::Poisson:
+				packets = mean_packets_ > 0 ? std::poisson_distribution<size_t>(mean_packets_)(rng_) : 0;
+				break;
+			case Distribution::Exponential:
+				packets = mean_packets_ > 0 ? std::exponential_distribution<double>(1.0 / mean_packets_)(rng_) : 0;
+				break;
+		}
+		return std::clamp(static_cast<size_t>(packets + 0.5), min_packets_, max_packets_);
+	}
+
+	void fillPayload_(uint8_t* out, size_t packets)
+	{
+		size_t bytes = packets * kPacketBytes;
+		switch (pattern_)
+		{
+			case Pattern::Zero:
+				memset(out, 0, bytes);
+				break;
+			case Pattern::Random:
+				for (size_t ii = 0; ii < bytes; ii += sizeof(uint64_t))
+				{
+					uint64_t word = rng_();
+					memcpy(out + ii, &word, sizeof(word));
+				}
+				break;
+			case Pattern::Counter:
+				for (size_t ii = 0; ii < bytes / sizeof(uint16_t); ++ii)
+				{
+					uint16_t word = ii;
+					memcpy(out + ii * sizeof(word), &word, sizeof(word));
+				}
+				break;
+		}
+	}
+
+	void generate_(Template& tmpl)
+	{
+		std::vector<size_t> packets(n_dtcs_ * links_ * rocs_per_link_);
+		size_t event_bytes = sizeof(DTCLib::DTC_EventHeader) + n_dtcs_ * sizeof(DTCLib::DTC_SubEventHeader);
+		for (auto& count : packets)
+		{
+			count = drawPackets_();
+			event_bytes += (count + 1) * kPacketBytes;
+		}
+
+		tmpl.bytes.assign(event_bytes, 0);
+		tmpl.subevents.clear();
+		tmpl.blocks.clear();
+		uint8_t* base = tmpl.bytes.data();
+
+		// Headers start from the zeroed buffer, so every field not set here is 0
+		DTCLib::DTC_EventHeader evt;
+		memcpy(&evt, base, sizeof(evt));
+		evt.inclusive_event_byte_count = event_bytes;
+		evt.num_dtcs = n_dtcs_;
+		memcpy(base, &evt, sizeof(evt));
+
+		size_t offset = sizeof(evt);
+		size_t block = 0;
+		for (size_t dtc = 0; dtc < n_dtcs_; ++dtc)
+		{
+			size_t sub_offset = offset;
+			tmpl.subevents.push_back(sub_offset);
+			offset += sizeof(DTCLib::DTC_SubEventHeader);
+
+			uint8_t dtc_id = first_dtc_id_ + dtc;
+			for (size_t link = 0; link < links_; ++link)
+			{
+				for (size_t roc = 0; roc < rocs_per_link_; ++roc, ++block)
+				{
+					DTCLib::DTC_DataHeaderPacket header(static_cast<DTCLib::DTC_Link_ID>(link), packets[block], DTCLib::DTC_DataStatus_Valid, dtc_id,
+														subsystem_, packet_version_, DTCLib::DTC_EventWindowTag(uint64_t(0)));
+					auto packet = header.ConvertToDataPacket();
+					memcpy(base + offset, packet.GetData(), kPacketBytes);
+					tmpl.blocks.push_back(offset);
+					fillPayload_(base + offset + kPacketBytes, packets[block]);
+					offset += (packets[block] + 1) * kPacketBytes;
+				}
+			}
+
+			DTCLib::DTC_SubEventHeader sub;
+			memcpy(&sub, base + sub_offset, sizeof(sub));
+			sub.inclusive_subevent_byte_count = offset - sub_offset;
+			sub.num_rocs = std::min(links_ * rocs_per_link_, size_t(255));
+			sub.source_dtc_id = dtc_id;
+			sub.subsystem = subsystem_;
+			memcpy(base + sub_offset, &sub, sizeof(sub));
+		}
+	}
+
+	size_t n_dtcs_;
+	uint8_t first_dtc_id_;
+	size_t links_;
+	size_t rocs_per_link_;
+	DTCLib::DTC_Subsystem subsystem_;
+	uint8_t packet_version_;
+	Distribution distribution_;
+	Pattern pattern_;
+	double mean_packets_;
+	size_t min_packets_;
+	size_t max_packets_;
+	bool clamped_{false};
+	std::mt19937_64 rng_;
+	std::vector<Template> templates_;
+	size_t next_{0};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
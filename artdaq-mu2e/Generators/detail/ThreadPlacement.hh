@@ -0,0 +1,127 @@
+#ifndef artdaq_mu2e_Generators_detail_ThreadPlacement_hh
+#define artdaq_mu2e_Generators_detail_ThreadPlacement_hh
+
+#include "fhiclcpp/ParameterSet.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace mu2e {
+namespace detail {
+
+// Pin the calling thread to a set of CPUs. An empty set (or a negative entry) leaves the affinity alone.
+// Returns false if the kernel refused the request (e.g. a CPU is not in the cpuset).
+inline bool pinCurrentThread(std::vector<int> const& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	bool any = false;
+	for (auto cpu : cpus)
+	{
+		if (cpu < 0) continue;
+		CPU_SET(cpu, &set);
+		any = true;
+	}
+	if (!any) return true;
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+inline bool pinCurrentThread(int cpu) { return pinCurrentThread(std::vector<int>{cpu}); }
+
+// NUMA node a CPU belongs to, or -1 if sysfs does not say
+inline int numaNodeOfCpu(int cpu)
+{
+	if (cpu < 0) return -1;
+	for (int node = 0; node < 64; ++node)
+	{
+		std::ifstream f("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/node" + std::to_string(node) + "/cpulist");
+		if (f.good()) return node;
+	}
+	return -1;
+}
+
+// NUMA node of the PCIe slot holding DTC dtc_id, as reported by the mu2e driver's sysfs entry; -1 if unknown
+inline int numaNodeOfDTC(int dtc_id)
+{
+	if (dtc_id < 0) return -1;
+	std::ifstream f("/sys/class/mu2e/mu2e" + std::to_string(dtc_id) + "/device/numa_node");
+	int node = -1;
+	if (!(f >> node)) return -1;
+	return node;
+}
+
+// Make node the preferred source of pages for the calling thread's future allocations
+inline bool preferNumaNode(int node)
+{
+	if (node < 0 || node >= 64) return true;
+	unsigned long mask = 1UL << node;
+	return syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8) == 0;
+}
+
+// Prefer node for the not-yet-faulted pages in [addr, addr + bytes); addr and bytes must be page-aligned
+inline bool bindToNumaNode(void* addr, size_t bytes, int node)
+{
+	if (node < 0 || node >= 64 || bytes == 0) return true;
+	unsigned long mask = 1UL << node;
+	return syscall(SYS_mbind, addr, bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) == 0;
+}
+
+// Where a readout thread runs and where its Fragment memory comes from.
+//   readout_cpus:      CPUs the readout thread is pinned to (default: not pinned)
+//   readout_numa_node: node for Fragment memory; -1 uses the DTC's node, then the node of the first readout CPU
+struct ThreadPlacement
+{
+	ThreadPlacement() = default;
+
+	ThreadPlacement(std::vector<int> cpus_in, int numa_node_in, int dtc_id = -1)
+		: cpus(std::move(cpus_in)), numa_node(numa_node_in)
+	{
+		if (numa_node < 0) numa_node = numaNodeOfDTC(dtc_id);
+		if (numa_node < 0 && !cpus.empty()) numa_node = numaNodeOfCpu(cpus[0]);
+	}
+
+	ThreadPlacement(fhicl::ParameterSet const& ps, int dtc_id = -1)
+		: ThreadPlacement(ps.get<std::vector<int>>("readout_cpus", std::vector<int>()), ps.get<int>("readout_numa_node", -1), dtc_id) {}
+
+	// Apply to the calling thread. Returns false if either the pinning or the memory policy was refused.
+	bool apply() const
+	{
+		bool pinned = pinCurrentThread(cpus);
+		return preferNumaNode(numa_node) && pinned;
+	}
+
+	std::string describe() const
+	{
+		std::ostringstream s;
+		if (cpus.empty())
+		{
+			s << "CPUs: any";
+		}
+		else
+		{
+			s << "CPUs:";
+			for (auto cpu : cpus) s << " " << cpu;
+		}
+		s << ", NUMA node: ";
+		if (numa_node < 0)
+			s << "any";
+		else
+			s << numa_node;
+		return s.str();
+	}
+
+	std::vector<int> cpus;
+	int numa_node{-1};
+};
+
+}  // namespace detail
+}  // namespace mu2e
+
+#endif
@@ -0,0 +1,208 @@
+#include "artdaq-mu2e/Generators/detail/EWTSequencer.hh"
+
+#define BOOST_TEST_MODULE EWTSequencer_t
+#include "cetlib/quiet_unit_test.hpp"
+
+#include <vector>
+
+namespace {
+
+struct Emitted
+{
+	uint64_t ts;
+	artdaq::Fragment::sequence_id_t seq;
+};
+
+// Feed raw EWTs through unroll() and push() the way the receivers do, numbering Fragments in read
+// order and skipping the number of a dropped duplicate, then flush.
+std::vector<Emitted> run(mu2e::detail::EWTSequencer& sequencer, std::vector<uint64_t> const& raws)
+{
+	artdaq::FragmentPtrs output;
+	artdaq::Fragment::sequence_id_t seq = 1;
+	for (auto raw : raws)
+	{
+		auto ts = sequencer.unroll(raw);
+		sequencer.push(std::make_unique<artdaq::Fragment>(seq, 0, artdaq::Fragment::DataFragmentType, ts), output);
+		if (!sequencer.dropped()) ++seq;
+	}
+	sequencer.flush(output);
+
+	std::vector<Emitted> emitted;
+	for (auto& frag : output) emitted.push_back({frag->timestamp(), frag->sequenceID()});
+	return emitted;
+}
+
+fhicl::ParameterSet config(size_t window, size_t n_dtcs = 1)
+{
+	fhicl::ParameterSet ps;
+	ps.put<size_t>("ewt_reorder_window", window);
+	ps.put<size_t>("n_dtcs_in_chain", n_dtcs);
+	ps.put<uint64_t>("ewt_wrap_distance", 100);
+	return ps;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(EWTSequencer_test)
+
+BOOST_AUTO_TEST_CASE(PassThrough)
+{
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {10, 11, 12, 13});
+	BOOST_REQUIRE_EQUAL(out.size(), 4u);
+	for (size_t ii = 0; ii < out.size(); ++ii)
+	{
+		BOOST_CHECK_EQUAL(out[ii].ts, 10 + ii);
+		BOOST_CHECK_EQUAL(out[ii].seq, 1 + ii);
+	}
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(Reorder)
+{
+	mu2e::detail::EWTSequencer sequencer(config(2));
+	auto out = run(sequencer, {10, 12, 11, 13});
+	BOOST_REQUIRE_EQUAL(out.size(), 4u);
+	for (size_t ii = 0; ii < out.size(); ++ii)
+	{
+		BOOST_CHECK_EQUAL(out[ii].ts, 10 + ii);
+		BOOST_CHECK_EQUAL(out[ii].seq, 1 + ii);  // Renumbered in release order
+	}
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 0u);
+	BOOST_CHECK_EQUAL(sequencer.late(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(Gaps)
+{
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {10, 11, 14, 15});
+	BOOST_CHECK_EQUAL(out.size(), 4u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(DuplicateFirstTagIsNotALoop)
+{
+	// A repeat of the first EWT must neither restart the timeline nor reach the output
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {10, 11, 10, 12});
+	BOOST_REQUIRE_EQUAL(out.size(), 3u);
+	BOOST_CHECK_EQUAL(out[0].ts, 10u);
+	BOOST_CHECK_EQUAL(out[1].ts, 11u);
+	BOOST_CHECK_EQUAL(out[2].ts, 12u);
+	BOOST_CHECK_EQUAL(out[2].seq, 3u);  // Sequence IDs stay contiguous
+	BOOST_CHECK_EQUAL(sequencer.wraps(), 0u);
+	BOOST_CHECK_EQUAL(sequencer.duplicates(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(DuplicateInReorderBuffer)
+{
+	mu2e::detail::EWTSequencer sequencer(config(4));
+	auto out = run(sequencer, {10, 12, 12, 11});
+	BOOST_REQUIRE_EQUAL(out.size(), 3u);
+	BOOST_CHECK_EQUAL(out[2].ts, 12u);
+	BOOST_CHECK_EQUAL(out[2].seq, 3u);
+	BOOST_CHECK_EQUAL(sequencer.duplicates(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(LateFragmentIsPassedOn)
+{
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {10, 12, 11, 13});
+	BOOST_CHECK_EQUAL(out.size(), 4u);
+	BOOST_CHECK_EQUAL(sequencer.late(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.duplicates(), 0u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 0u);  // 11 was counted as a gap when 12 went out, then arrived
+}
+
+BOOST_AUTO_TEST_CASE(LateFragmentOnlyFillsItsOwnGap)
+{
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {10, 14, 12, 15});
+	BOOST_CHECK_EQUAL(out.size(), 4u);
+	BOOST_CHECK_EQUAL(sequencer.late(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 2u);  // 11 and 13 never came
+}
+
+BOOST_AUTO_TEST_CASE(LateFragmentBeforeFirstIsNotAGap)
+{
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {10, 11, 9});
+	BOOST_CHECK_EQUAL(out.size(), 3u);
+	BOOST_CHECK_EQUAL(sequencer.late(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(RepeatedLateFragmentIsADuplicate)
+{
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {10, 12, 11, 11, 13});
+	BOOST_REQUIRE_EQUAL(out.size(), 4u);
+	BOOST_CHECK_EQUAL(out[3].ts, 13u);
+	BOOST_CHECK_EQUAL(out[3].seq, 4u);
+	BOOST_CHECK_EQUAL(sequencer.late(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.duplicates(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(OutOfOrderAccounting)
+{
+	// 13 is held and reordered, 11 misses the window and comes late, 12 repeats, 16 never comes
+	mu2e::detail::EWTSequencer sequencer(config(1));
+	auto out = run(sequencer, {10, 12, 13, 11, 12, 15, 14, 17});
+	BOOST_CHECK_EQUAL(out.size(), 7u);
+	BOOST_CHECK_EQUAL(sequencer.late(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.duplicates(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 1u);
+}
+
+BOOST_AUTO_TEST_CASE(SparseRequestsWaitForTheWindow)
+{
+	// Request-driven readout (CRV) asks for scattered EWTs; with a reorder window they are held until it
+	// fills, and their sequence IDs are the ones of the requests
+	mu2e::detail::EWTSequencer sequencer(config(2));
+	artdaq::FragmentPtrs output;
+	artdaq::Fragment::sequence_id_t seqs[] = {7, 3, 5};
+	uint64_t tss[] = {30, 10, 20};
+	for (size_t ii = 0; ii < 2; ++ii)
+	{
+		BOOST_CHECK_EQUAL(sequencer.push(std::make_unique<artdaq::Fragment>(seqs[ii], 0, artdaq::Fragment::DataFragmentType, sequencer.unroll(tss[ii])), output, false), 0u);
+	}
+	BOOST_CHECK(output.empty());
+	BOOST_CHECK_EQUAL(sequencer.buffered(), 2u);
+
+	BOOST_CHECK_EQUAL(sequencer.push(std::make_unique<artdaq::Fragment>(seqs[2], 0, artdaq::Fragment::DataFragmentType, sequencer.unroll(tss[2])), output, false), 1u);
+	BOOST_CHECK_EQUAL(sequencer.flush(output), 2u);
+	BOOST_REQUIRE_EQUAL(output.size(), 3u);
+	auto it = output.begin();
+	for (size_t ii = 0; ii < 3; ++ii, ++it)
+	{
+		BOOST_CHECK_EQUAL((*it)->timestamp(), 10 * (ii + 1));
+		BOOST_CHECK_EQUAL((*it)->sequenceID(), 3 + 2 * ii);
+	}
+	BOOST_CHECK_EQUAL(sequencer.late(), 0u);
+	BOOST_CHECK_EQUAL(sequencer.duplicates(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(PlaybackLoop)
+{
+	// A backward jump of at least ewt_wrap_distance continues one step past the previous loop
+	mu2e::detail::EWTSequencer sequencer(config(0));
+	auto out = run(sequencer, {200, 201, 202, 10, 11});
+	BOOST_REQUIRE_EQUAL(out.size(), 5u);
+	BOOST_CHECK_EQUAL(out[3].ts, 203u);
+	BOOST_CHECK_EQUAL(out[4].ts, 204u);
+	BOOST_CHECK_EQUAL(sequencer.wraps(), 1u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(StepFollowsDTCChain)
+{
+	// With two DTCs in the chain each one sees every other EWT; that is not a gap
+	mu2e::detail::EWTSequencer sequencer(config(2, 2));
+	auto out = run(sequencer, {10, 14, 12, 16});
+	BOOST_REQUIRE_EQUAL(out.size(), 4u);
+	BOOST_CHECK_EQUAL(out[1].ts, 12u);
+	BOOST_CHECK_EQUAL(sequencer.gaps(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+#include "artdaq-mu2e/Generators/detail/RawOutputWriter.hh"
+
+#define BOOST_TEST_MODULE RawOutputWriter_t
+#include "cetlib/quiet_unit_test.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t kMagic = 0xE7E7E7E7;
+
+// An event is its magic, its total size, its ID, then payload bytes equal to the ID
+std::vector<uint8_t> makeEvent(uint32_t id, uint32_t bytes)
+{
+	std::vector<uint8_t> evt(bytes, static_cast<uint8_t>(id));
+	memcpy(evt.data(), &kMagic, 4);
+	memcpy(evt.data() + 4, &bytes, 4);
+	memcpy(evt.data() + 8, &id, 4);
+	return evt;
+}
+
+// Walk the file as whole events; returns their IDs, or fails the test if any byte is out of place
+std::vector<uint32_t> readEvents(std::vector<uint8_t> const& file)
+{
+	std::vector<uint32_t> ids;
+	size_t offset = 0;
+	while (offset < file.size())
+	{
+		BOOST_REQUIRE_GE(file.size() - offset, 12u);
+		uint32_t magic, bytes, id;
+		memcpy(&magic, file.data() + offset, 4);
+		memcpy(&bytes, file.data() + offset + 4, 4);
+		memcpy(&id, file.data() + offset + 8, 4);
+		BOOST_REQUIRE_EQUAL(magic, kMagic);
+		BOOST_REQUIRE_LE(bytes, file.size() - offset);
+		for (size_t ii = 12; ii < bytes; ++ii) BOOST_REQUIRE_EQUAL(file[offset + ii], static_cast<uint8_t>(id));
+		ids.push_back(id);
+		offset += bytes;
+	}
+	return ids;
+}
+
+std::vector<uint8_t> slurp(std::string const& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(RawOutputWriter_test)
+
+BOOST_AUTO_TEST_CASE(DropOldestResyncsPastALargeEvent)
+{
+	char dir_template[] = "/tmp/RawOutputWriter_t.XXXXXX";
+	std::string dir = mkdtemp(dir_template);
+	std::string first_file = dir + "/out.bin";
+	std::string second_file = dir + "/out_1.bin";
+
+	// The first file is a FIFO, so the writer thread blocks opening it and the queue fills up behind it
+	BOOST_REQUIRE_EQUAL(mkfifo(first_file.c_str(), 0644), 0);
+
+	mu2e::detail::RawOutputWriter::Config config;
+	config.file_name = first_file;
+	config.buffer_bytes = 4096;
+	config.buffer_count = 4;
+	config.drop_policy = mu2e::detail::RawOutputWriter::DropPolicy::DropOldest;
+	mu2e::detail::RawOutputWriter writer(config);
+
+	// Event 2 fills the first buffer, which the writer thread takes and holds while it waits on the FIFO
+	auto evt1 = makeEvent(1, 1000);
+	auto evt2 = makeEvent(2, 6000);
+	BOOST_REQUIRE(writer.write(evt1.data(), evt1.size()));
+	BOOST_REQUIRE(writer.write(evt2.data(), evt2.size()));
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	// Event 3 starts in the second buffer and fills the third without starting anything in it. Event 4
+	// needs a buffer, so the second one is discarded: the third is then all the middle of event 3.
+	auto evt3 = makeEvent(3, 6000);
+	auto evt4 = makeEvent(4, 6000);
+	auto evt5 = makeEvent(5, 100);
+	BOOST_REQUIRE(writer.write(evt3.data(), evt3.size()));
+	BOOST_REQUIRE(writer.write(evt4.data(), evt4.size()));
+	BOOST_REQUIRE(writer.write(evt5.data(), evt5.size()));
+	BOOST_CHECK_GE(writer.dropped(), 1u);
+
+	int fifo = open(first_file.c_str(), O_RDONLY);
+	BOOST_REQUIRE_GE(fifo, 0);
+	writer.close();
+	std::vector<uint8_t> first(64 << 10);
+	size_t first_bytes = 0;
+	ssize_t ret;
+	while ((ret = read(fifo, first.data() + first_bytes, first.size() - first_bytes)) > 0) first_bytes += ret;
+	::close(fifo);
+	BOOST_CHECK_EQUAL(first_bytes, 4096u);  // Event 1 and the start of event 2; the file ends at the gap
+
+	// The file after the gap holds whole events only, starting with the first one after the discarded data
+	auto ids = readEvents(slurp(second_file));
+	BOOST_REQUIRE_EQUAL(ids.size(), 2u);
+	BOOST_CHECK_EQUAL(ids[0], 4u);
+	BOOST_CHECK_EQUAL(ids[1], 5u);
+
+	std::remove(first_file.c_str());
+	std::remove(second_file.c_str());
+	rmdir(dir.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(WritesEverythingWithoutDrops)
+{
+	char dir_template[] = "/tmp/RawOutputWriter_t.XXXXXX";
+	std::string dir = mkdtemp(dir_template);
+	std::string file = dir + "/out.bin";
+
+	mu2e::detail::RawOutputWriter::Config config;
+	config.file_name = file;
+	config.buffer_bytes = 4096;
+	config.buffer_count = 4;
+	config.drop_policy = mu2e::detail::RawOutputWriter::DropPolicy::Block;
+	{
+		mu2e::detail::RawOutputWriter writer(config);
+		for (uint32_t id = 1; id <= 20; ++id)
+		{
+			auto evt = makeEvent(id, 100 + 250 * id);
+			BOOST_REQUIRE(writer.write(evt.data(), evt.size()));
+		}
+		writer.close();
+		BOOST_CHECK_EQUAL(writer.dropped(), 0u);
+	}
+
+	auto ids = readEvents(slurp(file));
+	BOOST_REQUIRE_EQUAL(ids.size(), 20u);
+	for (uint32_t ii = 0; ii < ids.size(); ++ii) BOOST_CHECK_EQUAL(ids[ii], ii + 1);
+
+	std::remove(file.c_str());
+	rmdir(dir.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,128 @@
+#include "artdaq-mu2e/Generators/detail/STMCompression.hh"
+
+#define BOOST_TEST_MODULE STMCompression_t
+#include "cetlib/quiet_unit_test.hpp"
+
+#include <random>
+#include <vector>
+
+namespace {
+
+using mu2e::detail::STMCompressedMetadata;
+using mu2e::detail::STMCompressor;
+
+fhicl::ParameterSet config(bool zero_suppress, bool bitpack = true)
+{
+	fhicl::ParameterSet ps;
+	ps.put<bool>("enable", true);
+	ps.put<bool>("zero_suppress", zero_suppress);
+	ps.put<bool>("bitpack", bitpack);
+	return ps;
+}
+
+// Encode, check the metadata against the output, and decode again
+std::vector<int16_t> roundTrip(STMCompressor& compressor, std::vector<int16_t> const& samples, STMCompressedMetadata& md)
+{
+	std::vector<uint8_t> encoded(STMCompressor::maxEncodedBytes(samples.size()));
+	auto bytes = compressor.encode(samples.data(), samples.size(), encoded.data(), md);
+	BOOST_REQUIRE_LE(bytes, encoded.size());
+	BOOST_CHECK_EQUAL(md.encoded_bytes, bytes);
+	BOOST_CHECK_EQUAL(md.n_samples, samples.size());
+
+	std::vector<int16_t> decoded;
+	BOOST_REQUIRE(STMCompressor::decode(md, encoded.data(), bytes, decoded));
+	return decoded;
+}
+
+void checkLossless(std::vector<int16_t> const& samples, uint16_t expected_flag)
+{
+	STMCompressor compressor(config(false));
+	STMCompressedMetadata md;
+	auto decoded = roundTrip(compressor, samples, md);
+	BOOST_CHECK(md.flags & expected_flag);
+	BOOST_CHECK(!(md.flags & STMCompressedMetadata::ZeroSuppressed));
+	BOOST_CHECK_EQUAL_COLLECTIONS(decoded.begin(), decoded.end(), samples.begin(), samples.end());
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_SUITE(STMCompression_test)
+
+BOOST_AUTO_TEST_CASE(Empty)
+{
+	checkLossless({}, STMCompressedMetadata::StoredRaw);
+}
+
+BOOST_AUTO_TEST_CASE(PartialLastBlock)
+{
+	// Not a multiple of BLOCK_SAMPLES, slowly varying so bit-packing pays off
+	std::vector<int16_t> samples(3 * STMCompressor::BLOCK_SAMPLES + 45);
+	for (size_t ii = 0; ii < samples.size(); ++ii) samples[ii] = static_cast<int16_t>(1000 + (ii % 7) - 3);
+	checkLossless(samples, STMCompressedMetadata::DeltaBitPacked);
+}
+
+BOOST_AUTO_TEST_CASE(FullRangeDeltas)
+{
+	// One block swinging between the int16 limits (the widest zig-zag deltas), then a flat run so the
+	// slice as a whole still packs smaller than raw
+	std::vector<int16_t> samples(10 * STMCompressor::BLOCK_SAMPLES, 0);
+	for (size_t ii = 0; ii < STMCompressor::BLOCK_SAMPLES; ++ii) samples[ii] = ii % 2 ? 32767 : -32768;
+	checkLossless(samples, STMCompressedMetadata::DeltaBitPacked);
+
+	// The same with a fixed baseline at one end of the range, so residuals span the full 16 bits
+	fhicl::ParameterSet ps = config(false);
+	ps.put<int>("baseline", -32768);
+	ps.put<size_t>("baseline_samples", 0);
+	STMCompressor compressor(ps);
+	STMCompressedMetadata md;
+	auto decoded = roundTrip(compressor, samples, md);
+	BOOST_CHECK_EQUAL(md.baseline, -32768);
+	BOOST_CHECK_EQUAL_COLLECTIONS(decoded.begin(), decoded.end(), samples.begin(), samples.end());
+}
+
+BOOST_AUTO_TEST_CASE(StoredRawFallback)
+{
+	// Noise does not pack smaller than the samples themselves
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> dist(-32768, 32767);
+	std::vector<int16_t> samples(STMCompressor::BLOCK_SAMPLES * 2 + 1);
+	for (auto& sample : samples) sample = static_cast<int16_t>(dist(rng));
+	checkLossless(samples, STMCompressedMetadata::StoredRaw);
+
+	STMCompressor compressor(config(false, false));
+	STMCompressedMetadata md;
+	auto decoded = roundTrip(compressor, {1, 2, 3}, md);
+	BOOST_CHECK(md.flags & STMCompressedMetadata::StoredRaw);
+	BOOST_CHECK_EQUAL(md.encoded_bytes, 3 * sizeof(int16_t));
+}
+
+BOOST_AUTO_TEST_CASE(ZeroSuppression)
+{
+	fhicl::ParameterSet ps = config(true);
+	ps.put<int>("threshold", 10);
+	ps.put<int>("baseline", 100);
+	ps.put<size_t>("baseline_samples", 0);
+	STMCompressor compressor(ps);
+	STMCompressedMetadata md;
+	auto decoded = roundTrip(compressor, {105, 95, 100, 200, 111}, md);
+	std::vector<int16_t> expected{100, 100, 100, 200, 111};
+	BOOST_CHECK(md.flags & STMCompressedMetadata::ZeroSuppressed);
+	BOOST_CHECK_EQUAL_COLLECTIONS(decoded.begin(), decoded.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(DecodeRejectsBadInput)
+{
+	STMCompressor compressor(config(false));
+	std::vector<int16_t> samples(STMCompressor::BLOCK_SAMPLES, 5);
+	std::vector<uint8_t> encoded(STMCompressor::maxEncodedBytes(samples.size()));
+	STMCompressedMetadata md;
+	auto bytes = compressor.encode(samples.data(), samples.size(), encoded.data(), md);
+
+	std::vector<int16_t> decoded;
+	BOOST_CHECK(!STMCompressor::decode(md, encoded.data(), bytes - 1, decoded));
+	auto bad = md;
+	bad.magic = 0;
+	BOOST_CHECK(!STMCompressor::decode(bad, encoded.data(), bytes, decoded));
+}
+
+BOOST_AUTO_TEST_SUITE_END()